@@ -1,8 +1,9 @@
 #ifndef AST_H
 #define AST_H
 
-#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/StringRef.h"
+#include <cstdint>
 
 // Forward declarations of classes used in the AST
 class AST;
@@ -21,6 +22,15 @@ class Loop;
 class C;
 
 
+// Facts the value-range analysis proved about an arithmetic operation, CodeGen
+// turns them into IR flags and unsigned operations.
+enum ArithFlags : uint8_t
+{
+  AF_NoUnsignedWrap = 1 << 0, // The result does not wrap as an unsigned operation
+  AF_NonNegative = 1 << 1,    // Both operands are non-negative
+  AF_Exact = 1 << 2           // A division leaves no remainder
+};
+
 // ASTVisitor class defines a visitor pattern to traverse the AST
 class ASTVisitor
 {
@@ -30,9 +40,9 @@ public:
   virtual void visit(Expr &) {}             
   virtual void visit(Goal &) = 0; 
   virtual void visit(Statement &) = 0;           
-  virtual void visit(Factor &) = 0;         
+  virtual void visit(Final &) = 0;         
   virtual void visit(BinaryOp &) = 0;  
-  virtual void visit(Assignment &) = 0;      
+  virtual void visit(Condition &) = 0;      
   virtual void visit(Declaration &) = 0;    
   virtual void visit(Equation &) = 0;
   virtual void visit(If &) = 0;
@@ -46,15 +56,48 @@ public:
 class AST
 {
 public:
+  // Node kind tag, used for LLVM-style RTTI (isa/cast/dyn_cast) and for the
+  // switch dispatch of StaticVisitor. Subclass kinds are kept contiguous so
+  // classof can test a range.
+  enum NodeKind
+  {
+    NK_Goal,
+    NK_Final,
+    NK_BinaryOp,
+    NK_Declaration,
+    NK_Equation,
+    NK_If,
+    NK_Loop,
+    NK_Elif,
+    NK_Else,
+    NK_C,
+    NK_Condition
+  };
+
+private:
+  const NodeKind NKind;
+
+public:
+  AST(NodeKind K) : NKind(K) {}
   virtual ~AST() {}
+  NodeKind getNodeKind() const { return NKind; }
   virtual void accept(ASTVisitor &V) = 0;    // Accept a visitor for traversal
 };
 
 // Expr class represents an expression in the AST
 class Expr : public AST
 {
+  bool Shared; // Hash-consing handed out this node for more than one occurrence
+
 public:
-  Expr() {}
+  Expr(NodeKind K) : AST(K), Shared(false) {}
+
+  // A shared node stands for every occurrence of its expression, whatever a
+  // pass records in it must hold at all of them.
+  bool isShared() { return Shared; }
+  void setShared() { Shared = true; }
+
+  static bool classof(const AST *N) { return N->getNodeKind() >= NK_Goal && N->getNodeKind() <= NK_BinaryOp; }
 };
 
 // Goal class represents a group of statements in the AST
@@ -62,21 +105,25 @@ class Goal : public Expr
 {
 
 private:
-  lvm::SmallVector<Statement *> statements;                          // Stores the list of statements
+  llvm::ArrayRef<Statement *> statements;                            // Stores the list of statements
 
 public:
-  Goal(llvm::SmallVector<Statement *> statements) : statements(statements) {}
+  Goal(llvm::ArrayRef<Statement *> statements) : Expr(NK_Goal), statements(statements) {}
+
+  llvm::ArrayRef<Statement *> getStatements() { return statements; }
 
-  llvm::SmallVector<Statement *> getStatements() { return statements; }
+  void setStatements(llvm::ArrayRef<Statement *> S) { statements = S; }
 
-  ExprVector::const_iterator begin() { return statements.begin(); }
+  llvm::ArrayRef<Statement *>::iterator begin() { return statements.begin(); }
 
-  ExprVector::const_iterator end() { return statements.end(); }
+  llvm::ArrayRef<Statement *>::iterator end() { return statements.end(); }
 
   virtual void accept(ASTVisitor &V) override
   {
     V.visit(*this);
   }
+
+  static bool classof(const AST *N) { return N->getNodeKind() == NK_Goal; }
 };
 
 class Statement : public AST
@@ -93,13 +140,21 @@ public:
 private:
     StatementType Type;
 
+    static NodeKind nodeKindOf(StatementType type)
+    {
+        static const NodeKind Kinds[] = {NK_Declaration, NK_Equation, NK_If, NK_Loop};
+        return Kinds[type];
+    }
+
 public:
     StatementType getKind(){return Type;}
-    Statement(StatementType type) : Type(type) {}
+    Statement(StatementType type) : AST(nodeKindOf(type)), Type(type) {}
     virtual void accept(ASTVisitor &V) override
     {
         V.visit(*this);
     }
+
+    static bool classof(const AST *N) { return N->getNodeKind() >= NK_Declaration && N->getNodeKind() <= NK_Loop; }
 };
 
 // Final class represents a final in the AST (either an identifier or a number)
@@ -114,19 +169,28 @@ public:
 
 private:
   ValueKind Kind;                            // Stores the kind of factor (identifier or number)
-  llvm::StringRef Val;                       // Stores the value of the factor
+  llvm::StringRef Val;                       // Stores the source text of the factor
+  uint32_t Value;                            // Symbol ID of an identifier, value of a number
 
 public:
-  Final(ValueKind Kind, llvm::StringRef Val) : Kind(Kind), Val(Val), Expr() {}
+  Final(ValueKind Kind, llvm::StringRef Val, uint32_t Value)
+      : Expr(NK_Final), Kind(Kind), Val(Val), Value(Value) {}
 
   ValueKind getKind() { return Kind; }
 
   llvm::StringRef getVal() { return Val; }
 
+  uint32_t getSymbol() { return Value; }
+
+  int getNumber() { return (int)Value; }
+
+
   virtual void accept(ASTVisitor &V) override
   {
     V.visit(*this);
   }
+
+  static bool classof(const AST *N) { return N->getNodeKind() == NK_Final; }
 };
 
 // BinaryOp class represents a binary operation in the AST (plus, minus, multiplication, division, power, modxq)
@@ -147,20 +211,40 @@ private:
   Expr *Left;                               // Left-hand side expression
   Expr *Right;                              // Right-hand side expression
   Operator Op;                              // Operator of the binary operation
+  uint8_t Flags;                            // ArithFlags
+  bool Reused;                              // Later nodes take their value from this one
+  BinaryOp *Same;                           // An earlier node with the same value
 
 public:
-  BinaryOp(Operator Op, Expr *L, Expr *R) : Op(Op), Left(L), Right(R), Expr() {}
+  BinaryOp(Operator Op, Expr *L, Expr *R)
+      : Expr(NK_BinaryOp), Left(L), Right(R), Op(Op), Flags(0), Reused(false), Same(nullptr) {}
 
   Expr *getLeft() { return Left; }
 
   Expr *getRight() { return Right; }
 
+  void setLeft(Expr *L) { Left = L; }
+
+  void setRight(Expr *R) { Right = R; }
+
   Operator getOperator() { return Op; }
 
+  uint8_t getFlags() { return Flags; }
+
+  void setFlags(uint8_t F) { Flags = F; }
+
+  // Set by value numbering: Same is evaluated before this node on every
+  // path to it and has the same value.
+  BinaryOp *getSame() { return Same; }
+  void setSame(BinaryOp *S) { Same = S; S->Reused = true; }
+  bool isReused() { return Reused; }
+
   virtual void accept(ASTVisitor &V) override
   {
     V.visit(*this);
   }
+
+  static bool classof(const AST *N) { return N->getNodeKind() == NK_BinaryOp; }
 };
 
 
@@ -168,19 +252,23 @@ public:
 class Declaration : public Statement
 {
   private:
-    llvm::SmallVector<llvm::StringRef, 8> Vars;
-    llvm::SmallVector<Expr*> Exprs;
+    llvm::ArrayRef<uint32_t> Vars;           // Symbol IDs of the declared variables
+    llvm::ArrayRef<Expr*> Exprs;
 
 public:
-  Declaration(VarVector Vars, ExprVector Exprs) : Vars(Vars), Exprs(Exprs), Expr() {}
+  Declaration(llvm::ArrayRef<uint32_t> Vars, llvm::ArrayRef<Expr*> Exprs)
+      : Statement(Statement::Declaration), Vars(Vars), Exprs(Exprs) {}
 
-  llvm::SmallVector<llvm::StringRef, 8> getVars() { return Vars; }
-  llvm::SmallVector<Expr*> getExprs() { return Exprs; }
+  llvm::ArrayRef<uint32_t> getVars() { return Vars; }
+  llvm::ArrayRef<Expr*> getExprs() { return Exprs; }
+  void setExprs(llvm::ArrayRef<Expr*> E) { Exprs = E; }
 
   virtual void accept(ASTVisitor &V) override
   {
     V.visit(*this);
   }
+
+  static bool classof(const AST *N) { return N->getNodeKind() == NK_Declaration; }
 };
 
 class Equation : public Statement
@@ -200,9 +288,10 @@ class Equation : public Statement
     Final* Id;
     Expr* E;
     Operator Op;
+    uint8_t Flags; // ArithFlags of a compound assignment's operation
   
   public:
-    Equation(Final *Id, Expr *E, Operator Op) : Id(Id), E(E), Op(Op) {}
+    Equation(Final *Id, Expr *E, Operator Op) : Statement(Statement::Assignment), Id(Id), E(E), Op(Op), Flags(0) {}
     
     Final *getId() { return Id; }
 
@@ -210,7 +299,21 @@ class Equation : public Statement
 
     Operator getOp(){return Op;}
 
-}
+    void setE(Expr *NewE) { E = NewE; }
+
+    void setOp(Operator NewOp) { Op = NewOp; }
+
+    uint8_t getFlags() { return Flags; }
+
+    void setFlags(uint8_t F) { Flags = F; }
+
+    virtual void accept(ASTVisitor &V) override
+    {
+        V.visit(*this);
+    }
+
+    static bool classof(const AST *N) { return N->getNodeKind() == NK_Equation; }
+};
 
 class C : public AST
 {
@@ -225,17 +328,24 @@ class C : public AST
     C *Right;
     LogicOp LOp;
 
+  protected:
+    C(NodeKind K) : AST(K), Left(nullptr), Right(nullptr), LOp(KW_and) {}
+
   public:
-    C(Condition *L, Condition *R, LogicOp LO) : Left(L), Right(R), LOp(LO){} C() {}
+    C(C *L, C *R, LogicOp LO) : AST(NK_C), Left(L), Right(R), LOp(LO) {}
     C *getLeft() {return Left;}
     C *getRight() { return Right;}
-    C getLOp() {return Lop;} 
+    void setLeft(C *L) { Left = L; }
+    void setRight(C *R) { Right = R; }
+    LogicOp getLOp() {return LOp;} 
 
     virtual void accept(ASTVisitor &V) override
     {
         V.visit(*this);
     } 
-}
+
+    static bool classof(const AST *N) { return N->getNodeKind() >= NK_C && N->getNodeKind() <= NK_Condition; }
+};
 
 class Condition : public C
 {
@@ -253,88 +363,110 @@ class Condition : public C
     Expr *Left;
     Expr *Right;
     OperatorCondition OpC;
+    bool Reused;     // Later nodes take their value from this one
+    Condition *Same; // An earlier node with the same value
   public:
-    Condition(Expr *L, Expr *R, OperatorCondition C) : Left(L), Right(R), OpC(C), C() {}
+    Condition(Expr *L, Expr *R, OperatorCondition Op)
+        : C(NK_Condition), Left(L), Right(R), OpC(Op), Reused(false), Same(nullptr) {}
 
     Expr* getLeft(){return Left;}
     Expr* getRight(){return Right;}
+    void setLeft(Expr *L) { Left = L; }
+    void setRight(Expr *R) { Right = R; }
     OperatorCondition getOpC(){return OpC;}
 
+    // Set by value numbering, as for BinaryOp.
+    Condition *getSame() { return Same; }
+    void setSame(Condition *S) { Same = S; S->Reused = true; }
+    bool isReused() { return Reused; }
+
     virtual void accept(ASTVisitor &V) override
     {
         V.visit(*this);
     }
-}
+
+    static bool classof(const AST *N) { return N->getNodeKind() == NK_Condition; }
+};
 
 class If : public Statement
 {
   private:
     C* conditions;
-    llvm::SmallVector<Equation *> equations;
-    llvm::SmallVector<Elif *> elifs;
+    llvm::ArrayRef<Equation *> equations;
+    llvm::ArrayRef<Elif *> elifs;
     Else* elsestate;
 
   public:
-    If(C* cs, llvm::SmallVector<Equation *> eqs, llvm::SmallVector<Elif *> elfs,  Else* els) : 
-    conditions(cs), equation(eqs), elifs(elfs), elsestate(els) {}
+    If(C* cs, llvm::ArrayRef<Equation *> eqs, llvm::ArrayRef<Elif *> elfs,  Else* els) : 
+    Statement(Statement::If), conditions(cs), equations(eqs), elifs(elfs), elsestate(els) {}
     Else *getElsestate(){return elsestate;}
     C *getConditions(){return conditions;}
-    llvm::SmallVector<Equation *> getEquations(){return equations;}
-    llvm::SmallVector<Elif *> getElifs() {return elifs;}
+    void setConditions(C *cs) { conditions = cs; }
+    llvm::ArrayRef<Equation *> getEquations(){return equations;}
+    llvm::ArrayRef<Elif *> getElifs() {return elifs;}
 
     virtual void accept(ASTVisitor &V) override
     {
         V.visit(*this);
     }
-}
 
-class Else : public If
+    static bool classof(const AST *N) { return N->getNodeKind() == NK_If; }
+};
+
+class Else : public AST
 {
   private: 
-    llvm::SmallVector<Equation *> equations;
+    llvm::ArrayRef<Equation *> equations;
    
   public:
-    Else(lvm::SmallVector<Equation *> eqs) : equations(eqs), if() {}
-    llvm::SmallVector<Equation *> getEquations(){return equations;}
+    Else(llvm::ArrayRef<Equation *> eqs) : AST(NK_Else), equations(eqs) {}
+    llvm::ArrayRef<Equation *> getEquations(){return equations;}
 
     virtual void accept(ASTVisitor &V) override
     {
         V.visit(*this);
     }
-}
 
-class Elif : public If
+    static bool classof(const AST *N) { return N->getNodeKind() == NK_Else; }
+};
+
+class Elif : public AST
 {
   private: 
     C* conditions;
-    llvm::SmallVector<Equation *> equations;
+    llvm::ArrayRef<Equation *> equations;
    
   public:
-    Else(C* cs, lvm::SmallVector<Equation *> eqs) : conditions(cs) , equations(eqs), if() {}
-    llvm::SmallVector<Equation *> getEquations(){return equations;}
+    Elif(C* cs, llvm::ArrayRef<Equation *> eqs) : AST(NK_Elif), conditions(cs) , equations(eqs) {}
+    llvm::ArrayRef<Equation *> getEquations(){return equations;}
     C* getConditions(){return conditions;}
+    void setConditions(C *cs) { conditions = cs; }
     virtual void accept(ASTVisitor &V) override
     {
         V.visit(*this);
     }
-}
+
+    static bool classof(const AST *N) { return N->getNodeKind() == NK_Elif; }
+};
 
 class Loop : public Statement
 {
   private: 
     C* conditions;
-    llvm::SmallVector<Equation *> equations;
+    llvm::ArrayRef<Equation *> equations;
    
   public:
-    Loop(C* cs, lvm::SmallVector<Equation *> eqs) : conditions(cs) , equations(eqs), if() {}
+    Loop(C* cs, llvm::ArrayRef<Equation *> eqs) : Statement(Statement::Loop), conditions(cs) , equations(eqs) {}
     C* getConditions(){return conditions;}
-    llvm::SmallVector<Equation *> getEquations(){return equations;}
+    void setConditions(C *cs) { conditions = cs; }
+    llvm::ArrayRef<Equation *> getEquations(){return equations;}
     
     virtual void accept(ASTVisitor &V) override
     {
         V.visit(*this);
     }
 
-}
+    static bool classof(const AST *N) { return N->getNodeKind() == NK_Loop; }
+};
 
 #endif
\ No newline at end of file
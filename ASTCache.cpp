@@ -0,0 +1,334 @@
+#include "ASTCache.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstring>
+
+namespace
+{
+  const char Magic[4] = {'G', 'S', 'M', 'A'};
+  const uint32_t Version = 1;
+
+  struct Header
+  {
+    char Magic[4];
+    uint32_t Version;
+    uint64_t SourceSize; // Guards against a hash collision on top of the key
+    uint32_t NumNodes;
+    uint32_t NumSymbols;
+    uint32_t NamesSize;
+    uint32_t Padding;
+  };
+
+  size_t alignTo4(size_t N) { return (N + 3) & ~size_t(3); }
+
+  // Rebuilds the pointer tree from post-order node arrays. Finished subtrees
+  // wait on a stack until their parent comes along and takes the ones that
+  // lie inside its range. An entry that does not describe a well-formed tree
+  // makes build() fail instead of producing a broken AST.
+  class TreeBuilder
+  {
+    llvm::ArrayRef<uint8_t> Kinds;
+    llvm::ArrayRef<uint32_t> Data;
+    llvm::ArrayRef<uint32_t> Sizes;
+    llvm::ArrayRef<uint32_t> SymbolMap; // Entry symbol IDs to table IDs
+    const SymbolTable &Symbols;
+    ASTContext &Context;
+
+    struct Entry
+    {
+      uint32_t Node;
+      AST *Tree;
+    };
+    llvm::SmallVector<Entry, 64> Stack;
+    bool Valid;
+
+    template <typename T> T *as(AST *Node)
+    {
+      T *Res = llvm::dyn_cast<T>(Node);
+      if (!Res)
+        Valid = false;
+      return Res;
+    }
+
+    Final *makeId(uint32_t ID)
+    {
+      if (ID >= SymbolMap.size())
+      {
+        Valid = false;
+        return nullptr;
+      }
+      ID = SymbolMap[ID];
+      return Context.create<Final>(Final::Id, Symbols.getName(ID), ID);
+    }
+
+    llvm::ArrayRef<Equation *> equations(llvm::ArrayRef<AST *> Children)
+    {
+      llvm::SmallVector<Equation *, 8> Eqs;
+      for (AST *Child : Children)
+        Eqs.push_back(as<Equation>(Child));
+      return Context.copy(Eqs);
+    }
+
+    AST *buildNode(uint32_t N, llvm::ArrayRef<AST *> Ch)
+    {
+      FlatAST::NodeKind Kind = (FlatAST::NodeKind)Kinds[N];
+      uint32_t D = Data[N];
+      switch (Kind)
+      {
+      case FlatAST::Num:
+        if (!Ch.empty())
+          return nullptr;
+        return Context.create<Final>(Final::Num, llvm::StringRef(), D);
+      case FlatAST::Id:
+        if (!Ch.empty())
+          return nullptr;
+        return makeId(D);
+      case FlatAST::Add:
+      case FlatAST::Sub:
+      case FlatAST::Mul:
+      case FlatAST::Div:
+      case FlatAST::Rem:
+      case FlatAST::Pow:
+        if (Ch.size() != 2)
+          return nullptr;
+        return Context.create<BinaryOp>((BinaryOp::Operator)(Kind - FlatAST::Add),
+                                        as<Expr>(Ch[0]), as<Expr>(Ch[1]));
+      case FlatAST::Greater:
+      case FlatAST::Less:
+      case FlatAST::GreaterEqual:
+      case FlatAST::LessEqual:
+      case FlatAST::EqualEqual:
+      case FlatAST::NotEqual:
+        if (Ch.size() != 2)
+          return nullptr;
+        return Context.create<Condition>(as<Expr>(Ch[0]), as<Expr>(Ch[1]),
+                                         (Condition::OperatorCondition)(Kind - FlatAST::Greater));
+      case FlatAST::And:
+      case FlatAST::Or:
+        if (Ch.size() != 2)
+          return nullptr;
+        return Context.create<C>(as<C>(Ch[0]), as<C>(Ch[1]),
+                                 Kind == FlatAST::And ? C::KW_and : C::KW_or);
+      case FlatAST::Declare:
+      {
+        // Every flat Declare becomes a declaration of its own, which behaves
+        // the same as the original list.
+        if (Ch.size() > 1)
+          return nullptr;
+        if (D >= SymbolMap.size())
+          return nullptr;
+        uint32_t Var = SymbolMap[D];
+        llvm::SmallVector<Expr *, 1> Exprs;
+        if (!Ch.empty())
+          Exprs.push_back(as<Expr>(Ch[0]));
+        return Context.create<Declaration>(Context.copy(llvm::ArrayRef<uint32_t>(Var)),
+                                           Context.copy(Exprs));
+      }
+      case FlatAST::Assign:
+      case FlatAST::AddAssign:
+      case FlatAST::SubAssign:
+      case FlatAST::MulAssign:
+      case FlatAST::DivAssign:
+      case FlatAST::RemAssign:
+        if (Ch.size() != 1)
+          return nullptr;
+        return Context.create<Equation>(makeId(D), as<Expr>(Ch[0]),
+                                        (Equation::Operator)(Kind - FlatAST::Assign));
+      case FlatAST::If:
+      {
+        if (Ch.size() < 1 + (size_t)D)
+          return nullptr;
+        llvm::ArrayRef<AST *> Arms = Ch.drop_front(1 + D);
+        Else *ElseArm = nullptr;
+        if (!Arms.empty() && llvm::isa<Else>(Arms.back()))
+        {
+          ElseArm = llvm::cast<Else>(Arms.back());
+          Arms = Arms.drop_back();
+        }
+        llvm::SmallVector<Elif *, 4> Elifs;
+        for (AST *Arm : Arms)
+          Elifs.push_back(as<Elif>(Arm));
+        return Context.create<If>(as<C>(Ch[0]), equations(Ch.slice(1, D)),
+                                  Context.copy(Elifs), ElseArm);
+      }
+      case FlatAST::ElifArm:
+        if (Ch.empty())
+          return nullptr;
+        return Context.create<Elif>(as<C>(Ch[0]), equations(Ch.drop_front()));
+      case FlatAST::ElseArm:
+        return Context.create<Else>(equations(Ch));
+      case FlatAST::Loop:
+        if (Ch.empty())
+          return nullptr;
+        return Context.create<Loop>(as<C>(Ch[0]), equations(Ch.drop_front()));
+      case FlatAST::Goal:
+      {
+        llvm::SmallVector<Statement *, 16> Statements;
+        for (AST *Child : Ch)
+          Statements.push_back(as<Statement>(Child));
+        return Context.create<Goal>(Context.copy(Statements));
+      }
+      }
+      return nullptr;
+    }
+
+  public:
+    TreeBuilder(llvm::ArrayRef<uint8_t> Kinds, llvm::ArrayRef<uint32_t> Data,
+                llvm::ArrayRef<uint32_t> Sizes, llvm::ArrayRef<uint32_t> SymbolMap,
+                const SymbolTable &Symbols, ASTContext &Context)
+        : Kinds(Kinds), Data(Data), Sizes(Sizes), SymbolMap(SymbolMap), Symbols(Symbols),
+          Context(Context), Valid(true) {}
+
+    Goal *build()
+    {
+      llvm::SmallVector<AST *, 16> Children;
+      for (uint32_t N = 0; N < Kinds.size(); ++N)
+      {
+        if (Sizes[N] == 0 || Sizes[N] > N + 1)
+          return nullptr;
+        uint32_t First = N + 1 - Sizes[N];
+        size_t I = Stack.size();
+        while (I > 0 && Stack[I - 1].Node >= First)
+          --I;
+        Children.clear();
+        for (size_t J = I; J < Stack.size(); ++J)
+          Children.push_back(Stack[J].Tree);
+        Stack.resize(I);
+
+        AST *Tree = buildNode(N, Children);
+        if (!Tree || !Valid)
+          return nullptr;
+        Stack.push_back({N, Tree});
+      }
+      if (Stack.size() != 1)
+        return nullptr;
+      return llvm::dyn_cast<Goal>(Stack.back().Tree);
+    }
+  };
+} // namespace
+
+std::string ASTCache::getPath(llvm::StringRef Source) const
+{
+  llvm::SmallString<128> Path(Dir);
+  llvm::sys::path::append(Path, llvm::toHex(llvm::SHA1::hash(llvm::arrayRefFromStringRef(Source)),
+                                            /*LowerCase=*/true) +
+                                    ".ast");
+  return std::string(Path.str());
+}
+
+Goal *ASTCache::load(llvm::StringRef Source, SymbolTable &Symbols, ASTContext &Context)
+{
+  // Large entries are mapped rather than read, the node arrays are used in place.
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> BufOrErr =
+      llvm::MemoryBuffer::getFile(getPath(Source), /*IsText=*/false,
+                                  /*RequiresNullTerminator=*/false);
+  if (!BufOrErr)
+    return nullptr;
+  llvm::StringRef Buf = (*BufOrErr)->getBuffer();
+
+  Header H;
+  if (Buf.size() < sizeof(Header))
+    return nullptr;
+  std::memcpy(&H, Buf.data(), sizeof(Header));
+  if (std::memcmp(H.Magic, Magic, sizeof(Magic)) || H.Version != Version ||
+      H.SourceSize != Source.size())
+    return nullptr;
+
+  size_t KindsOffset = sizeof(Header);
+  size_t DataOffset = KindsOffset + alignTo4(H.NumNodes);
+  size_t SizesOffset = DataOffset + sizeof(uint32_t) * H.NumNodes;
+  size_t EndsOffset = SizesOffset + sizeof(uint32_t) * H.NumNodes;
+  size_t NamesOffset = EndsOffset + sizeof(uint32_t) * H.NumSymbols;
+  if (NamesOffset + H.NamesSize != Buf.size())
+    return nullptr;
+
+  // The buffer is at least 16-byte aligned, so the arrays are aligned too.
+  const char *Base = Buf.data();
+  llvm::ArrayRef<uint8_t> Kinds(reinterpret_cast<const uint8_t *>(Base + KindsOffset), H.NumNodes);
+  llvm::ArrayRef<uint32_t> Data(reinterpret_cast<const uint32_t *>(Base + DataOffset), H.NumNodes);
+  llvm::ArrayRef<uint32_t> Sizes(reinterpret_cast<const uint32_t *>(Base + SizesOffset), H.NumNodes);
+  llvm::ArrayRef<uint32_t> Ends(reinterpret_cast<const uint32_t *>(Base + EndsOffset), H.NumSymbols);
+  llvm::StringRef Names(Base + NamesOffset, H.NamesSize);
+
+  // The table copies the names, nothing refers into the buffer afterwards.
+  std::vector<uint32_t> SymbolMap(H.NumSymbols);
+  uint32_t Begin = 0;
+  for (uint32_t ID = 0; ID < H.NumSymbols; ++ID)
+  {
+    if (Ends[ID] < Begin || Ends[ID] > H.NamesSize)
+      return nullptr;
+    SymbolMap[ID] = Symbols.intern(Names.slice(Begin, Ends[ID]));
+    Begin = Ends[ID];
+  }
+
+  TreeBuilder Builder(Kinds, Data, Sizes, SymbolMap, Symbols, Context);
+  return Builder.build();
+}
+
+void ASTCache::store(llvm::StringRef Source, const FlatAST &Tree, const SymbolTable &Symbols)
+{
+  if (std::error_code EC = llvm::sys::fs::create_directories(Dir))
+  {
+    llvm::errs() << "Could not create AST cache " << Dir << ": " << EC.message() << "\n";
+    return;
+  }
+
+  Header H;
+  std::memcpy(H.Magic, Magic, sizeof(Magic));
+  H.Version = Version;
+  H.SourceSize = Source.size();
+  H.NumNodes = Tree.size();
+  H.NumSymbols = Symbols.size();
+  H.Padding = 0;
+  std::vector<uint32_t> Ends(Symbols.size());
+  size_t NamesSize = 0;
+  for (uint32_t ID = 0; ID < Symbols.size(); ++ID)
+  {
+    NamesSize += Symbols.getName(ID).size();
+    Ends[ID] = NamesSize;
+  }
+  if (NamesSize > UINT32_MAX)
+    return;
+  H.NamesSize = NamesSize;
+
+  // Write to a unique temporary and rename it into place, so concurrent
+  // compilers never see a partial entry.
+  std::string Path = getPath(Source);
+  llvm::SmallString<128> TempPath;
+  int FD;
+  if (std::error_code EC = llvm::sys::fs::createUniqueFile(Path + ".tmp%%%%%%", FD, TempPath))
+  {
+    llvm::errs() << "Could not write AST cache entry " << Path << ": " << EC.message() << "\n";
+    return;
+  }
+
+  llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+  const uint8_t Zeros[4] = {0, 0, 0, 0};
+  OS.write(reinterpret_cast<const char *>(&H), sizeof(Header));
+  OS.write(reinterpret_cast<const char *>(Tree.getKinds().data()), Tree.size());
+  OS.write(reinterpret_cast<const char *>(Zeros), alignTo4(Tree.size()) - Tree.size());
+  OS.write(reinterpret_cast<const char *>(Tree.getData().data()), sizeof(uint32_t) * Tree.size());
+  OS.write(reinterpret_cast<const char *>(Tree.getSizes().data()), sizeof(uint32_t) * Tree.size());
+  OS.write(reinterpret_cast<const char *>(Ends.data()), sizeof(uint32_t) * Ends.size());
+  for (uint32_t ID = 0; ID < Symbols.size(); ++ID)
+    OS << Symbols.getName(ID);
+  OS.close();
+
+  std::error_code EC = OS.error();
+  if (EC)
+    OS.clear_error();
+  else
+    EC = llvm::sys::fs::rename(TempPath, Path);
+  if (EC)
+  {
+    llvm::errs() << "Could not write AST cache entry " << Path << ": " << EC.message() << "\n";
+    llvm::sys::fs::remove(TempPath);
+  }
+}
@@ -0,0 +1,40 @@
+#ifndef ASTCACHE_H
+#define ASTCACHE_H
+
+#include "AST.h"
+#include "ASTContext.h"
+#include "FlatAST.h"
+#include "SymbolTable.h"
+#include "llvm/ADT/StringRef.h"
+#include <string>
+
+// On-disk cache of checked programs, keyed by the SHA-1 of the source. An
+// entry holds the FlatAST node arrays and the symbol names, all addressed by
+// index or offset, so a hit maps the file and rebuilds the tree straight from
+// it without lexing, parsing or semantic analysis.
+//
+// Entry layout, native byte order:
+//   Header
+//   uint8_t  Kinds[NumNodes], padded to 4 bytes
+//   uint32_t Data[NumNodes]
+//   uint32_t Sizes[NumNodes]
+//   uint32_t NameEnds[NumSymbols]  end offset of each name in Names
+//   char     Names[NamesSize]
+class ASTCache
+{
+  std::string Dir;
+
+  std::string getPath(llvm::StringRef Source) const;
+
+public:
+  ASTCache(llvm::StringRef Dir) : Dir(Dir.str()) {}
+
+  // Rebuild the tree of Source in Context if it is cached, interning its
+  // symbols into Symbols. Returns null on a miss or an unusable entry.
+  Goal *load(llvm::StringRef Source, SymbolTable &Symbols, ASTContext &Context);
+
+  // Add a checked program. Failures are reported and otherwise ignored.
+  void store(llvm::StringRef Source, const FlatAST &Tree, const SymbolTable &Symbols);
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef ASTCONTEXT_H
+#define ASTCONTEXT_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Allocator.h"
+#include <memory>
+#include <utility>
+#include <vector>
+
+// ASTContext owns the memory of every AST node and child array. Nodes are
+// bump-allocated and never freed individually, all of it is released at once
+// when the context is destroyed, so nodes must not own resources that need a
+// destructor to run.
+class ASTContext
+{
+  llvm::BumpPtrAllocator Allocator;
+  std::vector<std::unique_ptr<ASTContext>> Children; // Contexts handed to worker threads
+
+public:
+  ASTContext() = default;
+  ASTContext(const ASTContext &) = delete;
+  ASTContext &operator=(const ASTContext &) = delete;
+
+  // Allocate and construct a node of type T.
+  template <typename T, typename... Args> T *create(Args &&...args)
+  {
+    return new (Allocator.Allocate<T>()) T(std::forward<Args>(args)...);
+  }
+
+  // Copy a child list into the context.
+  template <typename T> llvm::ArrayRef<T> copy(llvm::ArrayRef<T> Elts)
+  {
+    if (Elts.empty())
+      return llvm::ArrayRef<T>();
+    T *Mem = Allocator.Allocate<T>(Elts.size());
+    std::uninitialized_copy(Elts.begin(), Elts.end(), Mem);
+    return llvm::ArrayRef<T>(Mem, Elts.size());
+  }
+  template <typename T> llvm::ArrayRef<T> copy(const llvm::SmallVectorImpl<T> &Elts)
+  {
+    return copy(llvm::ArrayRef<T>(Elts));
+  }
+
+  // A context for another thread to allocate from. Its nodes live as long as
+  // this context. Not thread-safe, create children before starting workers.
+  ASTContext &createChild()
+  {
+    Children.push_back(std::make_unique<ASTContext>());
+    return *Children.back();
+  }
+
+  size_t getTotalMemory() const
+  {
+    size_t Total = Allocator.getTotalMemory();
+    for (const std::unique_ptr<ASTContext> &Child : Children)
+      Total += Child->getTotalMemory();
+    return Total;
+  }
+};
+
+#endif
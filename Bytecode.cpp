@@ -0,0 +1,434 @@
+#include "Bytecode.h"
+#include "Runtime.h"
+#include "StaticVisitor.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdlib>
+
+using namespace bytecode;
+
+// GCC and Clang take the address of a label, so every handler can jump
+// straight to the next one (direct threading). Other compilers dispatch
+// through a switch.
+#if defined(__GNUC__)
+#define BYTECODE_THREADED 1
+#endif
+
+namespace
+{
+  // Expressions return the register holding their value. Temporaries are
+  // released once the instruction reading them is emitted, an instruction
+  // may write a register it reads. Values that value numbering shares get
+  // a register of their own, which no later code overwrites.
+  class Compiler : public StaticVisitor<Compiler, uint32_t>
+  {
+    Program &Prog;
+    const SymbolTable &Symbols;
+    bool CountLoops;
+    llvm::DenseMap<int32_t, uint32_t> Constants;
+    llvm::DenseMap<AST *, uint32_t> Reused;
+    llvm::BitVector Temps; // Registers that are temporaries
+    llvm::SmallVector<uint32_t, 16> FreeTemps;
+
+    static const uint32_t NoDest = ~0u;
+
+    uint32_t newRegister()
+    {
+      Prog.Registers.push_back(0);
+      Temps.push_back(false);
+      return Prog.Registers.size() - 1;
+    }
+
+    uint32_t allocTemp()
+    {
+      if (!FreeTemps.empty())
+        return FreeTemps.pop_back_val();
+      uint32_t Reg = newRegister();
+      Temps.set(Reg);
+      return Reg;
+    }
+
+    void release(uint32_t Reg)
+    {
+      if (Temps.test(Reg))
+        FreeTemps.push_back(Reg);
+    }
+
+    uint32_t constant(int32_t Value)
+    {
+      auto It = Constants.find(Value);
+      if (It != Constants.end())
+        return It->second;
+      uint32_t Reg = newRegister();
+      Prog.Registers[Reg] = Value;
+      Constants[Value] = Reg;
+      return Reg;
+    }
+
+    size_t emit(Opcode Op, uint32_t A, uint32_t B = 0, uint32_t C = 0)
+    {
+      Prog.Code.push_back({Op, A, B, C});
+      return Prog.Code.size() - 1;
+    }
+
+    // Point the jump at Index to the next instruction emitted.
+    void patch(size_t Index) { Prog.Code[Index].B = Prog.Code.size(); }
+
+    // Move the value in Reg to Dest unless no destination was asked for.
+    uint32_t into(uint32_t Reg, uint32_t Dest)
+    {
+      if (Dest == NoDest || Dest == Reg)
+        return Reg;
+      emit(Move, Dest, Reg);
+      release(Reg);
+      return Dest;
+    }
+
+    // Emit Op on Left and Right into Dest, or a temporary without one.
+    // Node is the value numbered node, if any.
+    uint32_t emitOp(Opcode Op, uint32_t Left, uint32_t Right, uint32_t Dest, AST *Node, bool IsReused)
+    {
+      release(Left);
+      release(Right);
+      uint32_t Target;
+      if (IsReused)
+      {
+        auto It = Reused.try_emplace(Node, 0);
+        if (It.second)
+          It.first->second = newRegister();
+        Target = It.first->second;
+      }
+      else
+        Target = Dest == NoDest ? allocTemp() : Dest;
+      emit(Op, Target, Left, Right);
+      return IsReused ? into(Target, Dest) : Target;
+    }
+
+    // Evaluate E into the variable register Dest.
+    void emitInto(Expr *E, uint32_t Dest)
+    {
+      if (BinaryOp *B = llvm::dyn_cast<BinaryOp>(E))
+        emitBinaryOp(*B, Dest);
+      else
+        into(visit(E), Dest);
+    }
+
+    uint32_t emitBinaryOp(BinaryOp &Node, uint32_t Dest)
+    {
+      if (BinaryOp *Same = Node.getSame())
+        if (!CountLoops)
+          return into(Reused.lookup(Same), Dest);
+      static const Opcode Ops[] = {Add, Sub, Mul, Div, Rem, Pow};
+      uint32_t Left = visit(Node.getLeft());
+      uint32_t Right = visit(Node.getRight());
+      return emitOp(Ops[Node.getOperator()], Left, Right, Dest, &Node, Node.isReused() && !CountLoops);
+    }
+
+    void emitEquations(llvm::ArrayRef<Equation *> Equations)
+    {
+      for (Equation *Eq : Equations)
+        visit(Eq);
+    }
+
+  public:
+    Compiler(Program &Prog, const SymbolTable &Symbols, bool CountLoops)
+        : Prog(Prog), Symbols(Symbols), CountLoops(CountLoops)
+    {
+      for (unsigned I = 0; I < Symbols.size(); ++I)
+        newRegister();
+    }
+
+    uint32_t visitGoal(Goal &Node)
+    {
+      for (Statement *S : Node.getStatements())
+        visit(S);
+      // The output of the program is the final value of 'result'.
+      uint32_t Result = Symbols.lookup("result");
+      if (Result != SymbolTable::NotFound)
+        emit(Write, Result);
+      emit(Halt, 0);
+      return 0;
+    }
+
+    uint32_t visitFinal(Final &Node)
+    {
+      if (Node.getKind() == Final::Id)
+        return Node.getSymbol();
+      return constant(Node.getNumber());
+    }
+
+    uint32_t visitBinaryOp(BinaryOp &Node) { return emitBinaryOp(Node, NoDest); }
+
+    // Variables without an initializer are read from the input by name.
+    uint32_t visitDeclaration(Declaration &Node)
+    {
+      llvm::ArrayRef<uint32_t> Vars = Node.getVars();
+      llvm::ArrayRef<Expr *> Exprs = Node.getExprs();
+      for (size_t I = 0; I < Vars.size(); ++I)
+      {
+        if (I < Exprs.size())
+        {
+          emitInto(Exprs[I], Vars[I]);
+          continue;
+        }
+        Prog.Names.push_back(Symbols.getName(Vars[I]).str());
+        emit(Read, Vars[I], Prog.Names.size() - 1);
+      }
+      return 0;
+    }
+
+    uint32_t visitEquation(Equation &Node)
+    {
+      uint32_t Var = Node.getId()->getSymbol();
+      if (Node.getOp() == Equation::equal)
+      {
+        emitInto(Node.getE(), Var);
+        return 0;
+      }
+      static const Opcode Ops[] = {Add, Add, Sub, Mul, Div, Rem};
+      uint32_t Val = visit(Node.getE());
+      release(Val);
+      emit(Ops[Node.getOp()], Var, Var, Val);
+      return 0;
+    }
+
+    uint32_t visitCondition(Condition &Node)
+    {
+      if (Condition *Same = Node.getSame())
+        if (!CountLoops)
+          return Reused.lookup(Same);
+      static const Opcode Ops[] = {CmpGT, CmpLT, CmpGE, CmpLE, CmpEQ, CmpNE};
+      uint32_t Left = visit(Node.getLeft());
+      uint32_t Right = visit(Node.getRight());
+      return emitOp(Ops[Node.getOpC()], Left, Right, NoDest, &Node, Node.isReused() && !CountLoops);
+    }
+
+    uint32_t visitC(C &Node)
+    {
+      uint32_t Left = visit(Node.getLeft());
+      uint32_t Right = visit(Node.getRight());
+      return emitOp(Node.getLOp() == C::KW_and ? And : Or, Left, Right, NoDest, &Node, false);
+    }
+
+    // Each arm tests its condition and skips to the next arm if it fails,
+    // every arm but the last jumps to the end when it is done.
+    uint32_t visitIf(If &Node)
+    {
+      llvm::SmallVector<size_t, 4> ToEnd;
+      llvm::ArrayRef<Elif *> Elifs = Node.getElifs();
+      Else *ElseState = Node.getElsestate();
+      auto Arm = [&](C *Conditions, llvm::ArrayRef<Equation *> Equations, bool Last) {
+        uint32_t Cond = visit(Conditions);
+        release(Cond);
+        size_t Skip = emit(JumpIfFalse, Cond);
+        emitEquations(Equations);
+        if (!Last)
+          ToEnd.push_back(emit(Jump, 0));
+        patch(Skip);
+      };
+
+      Arm(Node.getConditions(), Node.getEquations(), Elifs.empty() && !ElseState);
+      for (size_t I = 0; I < Elifs.size(); ++I)
+        Arm(Elifs[I]->getConditions(), Elifs[I]->getEquations(), I + 1 == Elifs.size() && !ElseState);
+      if (ElseState)
+        emitEquations(ElseState->getEquations());
+      for (size_t Index : ToEnd)
+        patch(Index);
+      return 0;
+    }
+
+    // The condition is placed after the body, one jump per iteration.
+    uint32_t visitLoop(Loop &Node)
+    {
+      size_t Start = emit(Jump, 0);
+      uint32_t Body = Prog.Code.size();
+      emitEquations(Node.getEquations());
+      patch(Start);
+      size_t Boundary = 0;
+      if (CountLoops)
+      {
+        Prog.Loops.push_back(&Node);
+        Boundary = emit(Enter, Prog.Loops.size() - 1);
+      }
+      uint32_t Cond = visit(Node.getConditions());
+      release(Cond);
+      emit(JumpIfTrue, Cond, Body);
+      if (CountLoops)
+        patch(Boundary);
+      return 0;
+    }
+  };
+
+  int32_t wrap(int64_t V) { return (int32_t)(uint32_t)V; }
+
+  // Base ^ Exp as the generated code computes it: negative exponents round
+  // 1 / Base ^ -Exp toward zero.
+  int32_t power(int32_t Base, int32_t Exp)
+  {
+    if (Exp < 0)
+    {
+      if (Base == 1)
+        return 1;
+      if (Base == -1)
+        return (Exp & 1) ? -1 : 1;
+      return 0;
+    }
+    uint32_t Result = 1, Square = (uint32_t)Base;
+    for (uint32_t Bits = Exp; Bits; Bits >>= 1)
+    {
+      if (Bits & 1)
+        Result *= Square;
+      Square *= Square;
+    }
+    return (int32_t)Result;
+  }
+
+  [[noreturn]] void divisionByZero()
+  {
+    llvm::errs() << "Division by zero\n";
+    std::exit(1);
+  }
+} // namespace
+
+Program bytecode::compile(AST *Tree, const SymbolTable &Symbols, bool CountLoops)
+{
+  Program Prog;
+  Compiler(Prog, Symbols, CountLoops).visit(Tree);
+  return Prog;
+}
+
+int bytecode::execute(const Program &Prog, LoopHook *Hook)
+{
+  std::vector<int32_t> Registers(Prog.Registers);
+  int32_t *R = Registers.data();
+
+#ifdef BYTECODE_THREADED
+  // Replace each opcode with the address of its handler, in Opcode order.
+  static const void *const Handlers[] = {
+      &&L_Add, &&L_Sub, &&L_Mul, &&L_Div, &&L_Rem, &&L_Pow, &&L_CmpGT,
+      &&L_CmpLT, &&L_CmpGE, &&L_CmpLE, &&L_CmpEQ, &&L_CmpNE, &&L_And, &&L_Or,
+      &&L_Move, &&L_Read, &&L_Write, &&L_Jump, &&L_JumpIfFalse, &&L_JumpIfTrue, &&L_Enter,
+      &&L_Halt};
+  struct Threaded
+  {
+    const void *Handler;
+    uint32_t A, B, C;
+  };
+  std::vector<Threaded> Code;
+  Code.reserve(Prog.Code.size());
+  for (const Instruction &I : Prog.Code)
+    Code.push_back({Handlers[I.Op], I.A, I.B, I.C});
+  const Threaded *Base = Code.data();
+  const Threaded *IP = Base;
+#define OP(Name) L_##Name:
+#define NEXT() goto *(++IP)->Handler
+#define JUMP(Target)          \
+  do                          \
+  {                           \
+    IP = Base + (Target);     \
+    goto *IP->Handler;        \
+  } while (0)
+  goto *IP->Handler;
+#else
+  const Instruction *Base = Prog.Code.data();
+  const Instruction *IP = Base;
+#define OP(Name) case Name:
+#define NEXT()     \
+  do               \
+  {                \
+    ++IP;          \
+    goto Dispatch; \
+  } while (0)
+#define JUMP(Target)      \
+  do                      \
+  {                       \
+    IP = Base + (Target); \
+    goto Dispatch;        \
+  } while (0)
+Dispatch:
+  switch (IP->Op)
+  {
+#endif
+
+  OP(Add)
+  R[IP->A] = wrap((int64_t)R[IP->B] + R[IP->C]);
+  NEXT();
+  OP(Sub)
+  R[IP->A] = wrap((int64_t)R[IP->B] - R[IP->C]);
+  NEXT();
+  OP(Mul)
+  R[IP->A] = wrap((int64_t)R[IP->B] * R[IP->C]);
+  NEXT();
+  OP(Div)
+  if (R[IP->C] == 0)
+    divisionByZero();
+  R[IP->A] = wrap((int64_t)R[IP->B] / R[IP->C]);
+  NEXT();
+  OP(Rem)
+  if (R[IP->C] == 0)
+    divisionByZero();
+  R[IP->A] = wrap((int64_t)R[IP->B] % R[IP->C]);
+  NEXT();
+  OP(Pow)
+  R[IP->A] = power(R[IP->B], R[IP->C]);
+  NEXT();
+  OP(CmpGT)
+  R[IP->A] = R[IP->B] > R[IP->C];
+  NEXT();
+  OP(CmpLT)
+  R[IP->A] = R[IP->B] < R[IP->C];
+  NEXT();
+  OP(CmpGE)
+  R[IP->A] = R[IP->B] >= R[IP->C];
+  NEXT();
+  OP(CmpLE)
+  R[IP->A] = R[IP->B] <= R[IP->C];
+  NEXT();
+  OP(CmpEQ)
+  R[IP->A] = R[IP->B] == R[IP->C];
+  NEXT();
+  OP(CmpNE)
+  R[IP->A] = R[IP->B] != R[IP->C];
+  NEXT();
+  OP(And)
+  R[IP->A] = R[IP->B] & R[IP->C];
+  NEXT();
+  OP(Or)
+  R[IP->A] = R[IP->B] | R[IP->C];
+  NEXT();
+  OP(Move)
+  R[IP->A] = R[IP->B];
+  NEXT();
+  OP(Read)
+  R[IP->A] = runtime::read(Prog.Names[IP->B].c_str());
+  NEXT();
+  OP(Write)
+  runtime::write(R[IP->A]);
+  NEXT();
+  OP(Jump)
+  JUMP(IP->B);
+  OP(JumpIfFalse)
+  if (!R[IP->A])
+    JUMP(IP->B);
+  NEXT();
+  OP(JumpIfTrue)
+  if (R[IP->A])
+    JUMP(IP->B);
+  NEXT();
+  OP(Enter)
+  if (Hook && Hook->enter(IP->A, R))
+    JUMP(IP->B);
+  NEXT();
+  OP(Halt)
+  return 0;
+
+#ifndef BYTECODE_THREADED
+  }
+  return 0;
+#endif
+#undef OP
+#undef NEXT
+#undef JUMP
+}
@@ -0,0 +1,81 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "AST.h"
+#include "SymbolTable.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A register-based bytecode for running small programs without starting
+// LLVM. Registers hold 32-bit integers: the variables first, indexed by
+// symbol ID, then constants and temporaries. Every instruction has the same
+// width, a destination A and operands B and C, which are registers or, for
+// the jumps, instruction indices.
+namespace bytecode
+{
+  enum Opcode : uint32_t
+  {
+    Add,         // A = B + C
+    Sub,         // A = B - C
+    Mul,         // A = B * C
+    Div,         // A = B / C
+    Rem,         // A = B % C
+    Pow,         // A = B ^ C
+    CmpGT,       // A = B > C
+    CmpLT,       // A = B < C
+    CmpGE,       // A = B >= C
+    CmpLE,       // A = B <= C
+    CmpEQ,       // A = B == C
+    CmpNE,       // A = B != C
+    And,         // A = B & C, of two comparison results
+    Or,          // A = B | C, of two comparison results
+    Move,        // A = B
+    Read,        // A = the input value of the variable named Names[B]
+    Write,       // Output A
+    Jump,        // Continue at B
+    JumpIfFalse, // Continue at B if A is 0
+    JumpIfTrue,  // Continue at B if A is not 0
+    Enter,       // Iteration boundary of the loop Loops[A], continue at B if the hook ran the loop
+    Halt
+  };
+
+  struct Instruction
+  {
+    Opcode Op;
+    uint32_t A, B, C;
+  };
+
+  // Arithmetic wraps instead of being undefined on overflow, and division
+  // by zero stops the program with an error.
+  struct Program
+  {
+    std::vector<Instruction> Code;
+    std::vector<int32_t> Registers; // Initial values, the constants set
+    std::vector<std::string> Names; // Variable names of the reads
+    std::vector<Loop *> Loops;      // The loops of the Enter instructions
+  };
+
+  // Compile a checked tree, with the annotations of the passes run on it.
+  // With CountLoops each loopc starts its condition with an Enter, and the
+  // links of value numbering are ignored: a loop run by the hook leaves
+  // registers behind that no shared value could rely on.
+  Program compile(AST *Tree, const SymbolTable &Symbols, bool CountLoops = false);
+
+  // Called at every iteration boundary of a loop, before its condition.
+  class LoopHook
+  {
+  public:
+    virtual ~LoopHook() = default;
+
+    // Return true after running the rest of Prog.Loops[Loop] on the
+    // variable registers, false to keep interpreting it.
+    virtual bool enter(uint32_t Loop, int32_t *Registers) = 0;
+  };
+
+  // Run Prog to the end, reading and writing through the runtime. Returns
+  // what the generated main would return.
+  int execute(const Program &Prog, LoopHook *Hook = nullptr);
+} // namespace bytecode
+
+#endif
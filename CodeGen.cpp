@@ -1,17 +1,35 @@
 #include "CodeGen.h"
-#include "llvm/ADT/StringMap.h"
+#include "Runtime.h"
+#include "StaticVisitor.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 
 using namespace llvm;
 
 // Define a visitor class for generating LLVM IR from the AST.
 namespace
 {
-  class ToIRVisitor : public ASTVisitor
+  class ToIRVisitor : public StaticVisitor<ToIRVisitor, Value *>
   {
     Module *M;
+    const SymbolTable &Symbols;
     IRBuilder<> Builder;
     Type *VoidTy;
     Type *Int32Ty;
@@ -19,15 +37,194 @@ namespace
     Type *Int8PtrPtrTy;
     Constant *Int32Zero;
     Constant *Int32One;
+    Function *MainFn;
     Function *CalcWriteFn;
-    FunctionType *CalcWriteFnTy;    
+    FunctionType *CalcWriteFnTy;
+    Function *CalcReadFn;
+    FunctionType *CalcReadFnTy;
+    Function *PowFn;
 
-    Value *V;
-    StringMap<AllocaInst *> nameMap;
+    // Variables live in SSA values, not in memory. Vars is the current value
+    // of every variable at the insertion point, the handles follow a phi
+    // that is found trivial and replaced.
+    std::vector<WeakTrackingVH> Vars;       // Indexed by symbol ID
+    DenseMap<AST *, WeakTrackingVH> Reused; // Values of the nodes value numbering links others to
+
+    typedef SmallVector<uint32_t, 8> VarList;
+    typedef SmallVector<Value *, 8> ValueList;
+
+    void emitEquations(ArrayRef<Equation *> Equations)
+    {
+      for (Equation *Eq : Equations)
+        visit(Eq);
+    }
+
+    // Each variable the equations assign, once.
+    static void collectAssigned(ArrayRef<Equation *> Equations, VarList &Assigned)
+    {
+      for (Equation *Eq : Equations)
+        Assigned.push_back(Eq->getId()->getSymbol());
+    }
+
+    static void unique(VarList &Vars)
+    {
+      llvm::sort(Vars);
+      Vars.erase(std::unique(Vars.begin(), Vars.end()), Vars.end());
+    }
+
+    void save(const VarList &Assigned, ValueList &Saved)
+    {
+      Saved.clear();
+      for (uint32_t Var : Assigned)
+        Saved.push_back(Vars[Var]);
+    }
+
+    void restore(const VarList &Assigned, const ValueList &Saved)
+    {
+      for (size_t I = 0; I < Assigned.size(); ++I)
+        Vars[Assigned[I]] = Saved[I];
+    }
+
+    // A phi whose operands are all one value, apart from the phi itself, is
+    // replaced by that value. The phis using it may become trivial in turn
+    // (Braun et al., "Simple and Efficient Construction of SSA Form").
+    void removeTrivialPhi(PHINode *Phi)
+    {
+      Value *Same = nullptr;
+      for (Value *Op : Phi->incoming_values())
+      {
+        if (Op == Same || Op == Phi)
+          continue;
+        if (Same)
+          return;
+        Same = Op;
+      }
+      if (!Same)
+        Same = UndefValue::get(Int32Ty);
+      // Removing one user may already have removed another, the handles
+      // are cleared when that happens.
+      SmallVector<WeakTrackingVH, 4> Users;
+      for (User *U : Phi->users())
+        if (isa<PHINode>(U) && U != Phi)
+          Users.push_back(U);
+      Phi->replaceAllUsesWith(Same);
+      Phi->eraseFromParent();
+      for (WeakTrackingVH &U : Users)
+        if (PHINode *P = dyn_cast_or_null<PHINode>(U))
+          removeTrivialPhi(P);
+    }
+
+    // Arithmetic is signed and may not overflow, ArithFlags from the range
+    // analysis add nuw and exact and turn division unsigned.
+    Value *emitArith(BinaryOp::Operator Op, Value *Left, Value *Right, uint8_t Flags)
+    {
+      bool NUW = Flags & AF_NoUnsignedWrap;
+      bool Exact = Flags & AF_Exact;
+      bool Unsigned = Flags & AF_NonNegative;
+      switch (Op)
+      {
+      case BinaryOp::plus:
+        return Builder.CreateAdd(Left, Right, "", NUW, /*HasNSW=*/true);
+      case BinaryOp::minus:
+        return Builder.CreateSub(Left, Right, "", NUW, /*HasNSW=*/true);
+      case BinaryOp::star:
+        return Builder.CreateMul(Left, Right, "", NUW, /*HasNSW=*/true);
+      case BinaryOp::slash:
+        return Unsigned ? Builder.CreateUDiv(Left, Right, "", Exact)
+                        : Builder.CreateSDiv(Left, Right, "", Exact);
+      case BinaryOp::percent:
+        return Unsigned ? Builder.CreateURem(Left, Right) : Builder.CreateSRem(Left, Right);
+      case BinaryOp::pow:
+        break;
+      }
+      llvm_unreachable("unknown arithmetic operator");
+    }
+
+    // Base ^ N for N < 0 is 1 / Base ^ -N rounded toward zero: 1 for 1, 1 or
+    // -1 for -1 depending on Odd, the parity of N, and 0 for everything else,
+    // 0 included.
+    Value *emitNegativePow(IRBuilder<> &B, Value *Base, Value *Odd)
+    {
+      Constant *MinusOne = ConstantInt::get(Int32Ty, -1, true);
+      Value *ForMinusOne = B.CreateSelect(Odd, MinusOne, Int32One);
+      Value *V = B.CreateSelect(B.CreateICmpEQ(Base, MinusOne), ForMinusOne, Int32Zero);
+      return B.CreateSelect(B.CreateICmpEQ(Base, Int32One), Int32One, V);
+    }
+
+    // Base ^ N for a literal N by square-and-multiply from the top bit down,
+    // about 2 log2(N) multiplications. Every partial result is a power of
+    // Base no higher than N, so none overflows unless the result does.
+    Value *emitConstPow(Value *Base, int N)
+    {
+      if (N < 0)
+        return emitNegativePow(Builder, Base, Builder.getInt1(N & 1));
+      if (N == 0)
+        return Int32One;
+      Value *V = Base;
+      for (int Bit = (int)Log2_32(N) - 1; Bit >= 0; --Bit)
+      {
+        V = Builder.CreateNSWMul(V, V);
+        if ((N >> Bit) & 1)
+          V = Builder.CreateNSWMul(V, Base);
+      }
+      return V;
+    }
+
+    // Runtime exponents call an internal helper, emitted on first use, that
+    // squares and multiplies in a loop over the bits of the exponent.
+    Function *getPowFn()
+    {
+      if (PowFn)
+        return PowFn;
+      LLVMContext &Ctx = M->getContext();
+      FunctionType *PowFnTy = FunctionType::get(Int32Ty, {Int32Ty, Int32Ty}, false);
+      PowFn = Function::Create(PowFnTy, GlobalValue::InternalLinkage, "pow.i32", M);
+      Value *Base = PowFn->getArg(0);
+      Value *Exp = PowFn->getArg(1);
+
+      BasicBlock *EntryBB = BasicBlock::Create(Ctx, "entry", PowFn);
+      BasicBlock *NegBB = BasicBlock::Create(Ctx, "pow.neg", PowFn);
+      BasicBlock *LoopBB = BasicBlock::Create(Ctx, "pow.loop", PowFn);
+      BasicBlock *BodyBB = BasicBlock::Create(Ctx, "pow.body", PowFn);
+      BasicBlock *EndBB = BasicBlock::Create(Ctx, "pow.end", PowFn);
+      IRBuilder<> B(EntryBB);
+      B.CreateCondBr(B.CreateICmpSLT(Exp, Int32Zero), NegBB, LoopBB);
+
+      B.SetInsertPoint(NegBB);
+      B.CreateRet(emitNegativePow(B, Base, B.CreateTrunc(Exp, B.getInt1Ty())));
+
+      // The square is only needed while bits are left, it may wrap on the
+      // last iteration, so the multiplications carry no nsw.
+      B.SetInsertPoint(LoopBB);
+      PHINode *Result = B.CreatePHI(Int32Ty, 2);
+      PHINode *Square = B.CreatePHI(Int32Ty, 2);
+      PHINode *Bits = B.CreatePHI(Int32Ty, 2);
+      B.CreateCondBr(B.CreateICmpEQ(Bits, Int32Zero), EndBB, BodyBB);
+
+      B.SetInsertPoint(BodyBB);
+      Value *Odd = B.CreateTrunc(Bits, B.getInt1Ty());
+      Value *NextResult = B.CreateSelect(Odd, B.CreateMul(Result, Square), Result);
+      Value *NextSquare = B.CreateMul(Square, Square);
+      Value *NextBits = B.CreateLShr(Bits, 1);
+      B.CreateBr(LoopBB);
+
+      Result->addIncoming(Int32One, EntryBB);
+      Result->addIncoming(NextResult, BodyBB);
+      Square->addIncoming(Base, EntryBB);
+      Square->addIncoming(NextSquare, BodyBB);
+      Bits->addIncoming(Exp, EntryBB);
+      Bits->addIncoming(NextBits, BodyBB);
+
+      B.SetInsertPoint(EndBB);
+      B.CreateRet(Result);
+      return PowFn;
+    }
 
   public:
     // Constructor for the visitor class.
-    ToIRVisitor(Module *M) : M(M), Builder(M->getContext())
+    ToIRVisitor(Module *M, const SymbolTable &Symbols)
+        : M(M), Symbols(Symbols), Builder(M->getContext()), MainFn(nullptr), PowFn(nullptr),
+          Vars(Symbols.size())
     {
       // Initialize LLVM types and constants.
       VoidTy = Type::getVoidTy(M->getContext());
@@ -35,274 +232,605 @@ namespace
       Int8PtrTy = Type::getInt8PtrTy(M->getContext());
       Int8PtrPtrTy = Int8PtrTy->getPointerTo();
       Int32Zero = ConstantInt::get(Int32Ty, 0, true);
+      Int32One = ConstantInt::get(Int32Ty, 1, true);
       CalcWriteFnTy = FunctionType::get(VoidTy, {Int32Ty}, false);
       CalcWriteFn = Function::Create(CalcWriteFnTy, GlobalValue::ExternalLinkage, "main_write", M);
+      CalcReadFnTy = FunctionType::get(Int32Ty, {Int8PtrTy}, false);
+      CalcReadFn = Function::Create(CalcReadFnTy, GlobalValue::ExternalLinkage, "main_read", M);
     }
 
     // Entry point for generating LLVM IR from the AST.
     void run(AST *Tree)
     {
       // Create the main function with the appropriate function type.
-      FunctionType MainFty = FunctionType::get(Int32Ty, {Int32Ty, Int8PtrPtrTy}, false);
-      Function MainFn = Function::Create(MainFty, GlobalValue::ExternalLinkage, "main", M);
+      FunctionType *MainFty = FunctionType::get(Int32Ty, {Int32Ty, Int8PtrPtrTy}, false);
+      MainFn = Function::Create(MainFty, GlobalValue::ExternalLinkage, "main", M);
 
       // Create a basic block for the entry point of the main function.
       BasicBlock *BB = BasicBlock::Create(M->getContext(), "entry", MainFn);
       Builder.SetInsertPoint(BB);
 
       // Visit the root node of the AST to generate IR.
-      Tree->accept(*this);
+      visit(Tree);
+
+      // The output of the program is the final value of 'result'.
+      uint32_t Result = Symbols.lookup("result");
+      if (Result != SymbolTable::NotFound && Vars[Result])
+        Builder.CreateCall(CalcWriteFnTy, CalcWriteFn, {Vars[Result]});
 
       // Create a return instruction at the end of the main function.
       Builder.CreateRet(Int32Zero);
     }
 
-    // Visit function for the GSM node in the AST.
-    virtual void visit(Goal &Node) override
+    // Generate Name(i32 *Vars), which runs the loop Node to its end and
+    // stores the variables it assigns to Vars, indexed by symbol ID. Every
+    // variable starts as a constant, its value in LiveIn.
+    void runLoop(::Loop *Node, StringRef Name, ArrayRef<int32_t> LiveIn)
+    {
+      FunctionType *LoopFty = FunctionType::get(VoidTy, {Int32Ty->getPointerTo()}, false);
+      MainFn = Function::Create(LoopFty, GlobalValue::ExternalLinkage, Name, M);
+      BasicBlock *BB = BasicBlock::Create(M->getContext(), "entry", MainFn);
+      Builder.SetInsertPoint(BB);
+
+      for (size_t I = 0; I < LiveIn.size(); ++I)
+        Vars[I] = ConstantInt::get(Int32Ty, LiveIn[I], true);
+      visitLoop(*Node);
+
+      VarList Assigned;
+      collectAssigned(Node->getEquations(), Assigned);
+      unique(Assigned);
+      Value *Out = MainFn->getArg(0);
+      for (uint32_t Var : Assigned)
+        Builder.CreateStore(Vars[Var], Builder.CreateConstInBoundsGEP1_32(Int32Ty, Out, Var));
+      Builder.CreateRetVoid();
+    }
+
+    Value *visitGoal(Goal &Node)
     {
-      // Iterate over the children of the GSM node and visit each child.
-      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
+      for (Statement *S : Node.getStatements())
+        visit(S);
+      return nullptr;
+    }
+
+    Value *visitFinal(Final &Node)
+    {
+      // If the factor is an identifier, use the current value of the variable.
+      if (Node.getKind() == Final::Id)
+        return Vars[Node.getSymbol()];
+      // If the factor is a literal, create a constant from the value decoded by the lexer.
+      return ConstantInt::get(Int32Ty, Node.getNumber(), true);
+    }
+
+    Value *visitBinaryOp(BinaryOp &Node)
+    {
+      // A loop compiled on its own may be linked to a value outside of it,
+      // which is then computed again.
+      if (BinaryOp *Same = Node.getSame())
+        if (Value *V = Reused.lookup(Same))
+          return V;
+      Value *V = emitBinaryOp(Node);
+      if (Node.isReused())
+        Reused[&Node] = V;
+      return V;
+    }
+
+    Value *emitBinaryOp(BinaryOp &Node)
+    {
+      Value *Left = visit(Node.getLeft());
+
+      if (Node.getOperator() == BinaryOp::pow)
       {
-        (*I)->accept(*this);
+        Final *Exp = dyn_cast<Final>(Node.getRight());
+        if (Exp && Exp->getKind() == Final::Num)
+          return emitConstPow(Left, Exp->getNumber());
+        return Builder.CreateCall(getPowFn(), {Left, visit(Node.getRight())});
       }
-    };
-
-virtual void visit(Equation &Node) override {
-    
-    Node.getE()->accept(*this);
-    Value *rhsVal = V; /
-    auto varName = Node.getId()->getVal();
-
-    Value *varPtr = nameMap[varName];
-
-    Value *varValue = Builder.CreateLoad(varPtr);
-
-    switch (Node.getOp()) {
-        case Equation::equal:
-            // Simple assignment (=).
-            // will be handled outside the switch-case
-            break;
-        case Equation::plusequal:
-            // Addition-assignment (+=).
-            varValue = Builder.CreateAdd(varValue, rhsVal);
-            break;
-        case Equation::minusequal:
-            // Subtraction-assignment (-=).
-            varValue = Builder.CreateSub(varValue, rhsVal);
-            break;
-        case Equation::starequal:
-            // Multiplication-assignment (*=).
-            varValue = Builder.CreateMul(varValue, rhsVal);
-            break;
-        case Equation::slashequal:
-            // Division-assignment (/=).
-            varValue = Builder.CreateSDiv(varValue, rhsVal);
-            break;
-        case Equation::percentequal:
-            // Modulus-assignment (%=).
-            varValue = Builder.CreateSRem(varValue, rhsVal);
-            break;
+
+      Value *Right = visit(Node.getRight());
+      return emitArith(Node.getOperator(), Left, Right, Node.getFlags());
     }
 
-    Builder.CreateStore(varValue, varPtr);
+    // Variables without an initializer are read from the input by name.
+    Value *visitDeclaration(Declaration &Node)
+    {
+      ArrayRef<uint32_t> DeclVars = Node.getVars();
+      ArrayRef<Expr *> Exprs = Node.getExprs();
+      for (size_t I = 0; I < DeclVars.size(); ++I)
+      {
+        if (I < Exprs.size())
+          Vars[DeclVars[I]] = visit(Exprs[I]);
+        else
+        {
+          StringRef Name = Symbols.getName(DeclVars[I]);
+          Value *NamePtr = Builder.CreateGlobalStringPtr(Name);
+          Vars[DeclVars[I]] = Builder.CreateCall(CalcReadFnTy, CalcReadFn, {NamePtr}, Name);
+        }
+      }
+      return nullptr;
+    }
 
-  
-    FunctionType *CalcWriteFnTy = FunctionType::get(VoidTy, {Int32Ty}, false);
+    Value *visitEquation(Equation &Node)
+    {
+      Value *Val = visit(Node.getE());
 
-    // Create a function declaration for the "gsm_write" function.
-    Function *CalcWriteFn = Function::Create(CalcWriteFnTy, GlobalValue::ExternalLinkage, "gsm_write", M);
+      if (Node.getOp() != Equation::equal)
+      {
+        static const BinaryOp::Operator Ops[] = {BinaryOp::plus, BinaryOp::plus, BinaryOp::minus,
+                                                 BinaryOp::star, BinaryOp::slash, BinaryOp::percent};
+        Value *Old = Vars[Node.getId()->getSymbol()];
+        Val = emitArith(Ops[Node.getOp()], Old, Val, Node.getFlags());
+      }
 
-    // Create a call instruction to invoke the "gsm_write" function with the value.
-    CallInst *Call = Builder.CreateCall(CalcWriteFnTy, CalcWriteFn, {val});
-}
+      Vars[Node.getId()->getSymbol()] = Val;
+      return nullptr;
+    }
 
+    Value *visitCondition(Condition &Node)
+    {
+      if (Condition *Same = Node.getSame())
+        if (Value *V = Reused.lookup(Same))
+          return V;
+      Value *V = emitCondition(Node);
+      if (Node.isReused())
+        Reused[&Node] = V;
+      return V;
+    }
 
-    virtual void visit(Final &Node) override
+    Value *emitCondition(Condition &Node)
     {
-      if (Node.getKind() == Factor::Id)
+      Value *Left = visit(Node.getLeft());
+      Value *Right = visit(Node.getRight());
+      switch (Node.getOpC())
       {
-        // If the factor is an identifier, load its value from memory.
-        V = Builder.CreateLoad(Int32Ty, nameMap[Node.getVal()]);
+      case Condition::greater:
+        return Builder.CreateICmpSGT(Left, Right);
+      case Condition::less:
+        return Builder.CreateICmpSLT(Left, Right);
+      case Condition::greaterequal:
+        return Builder.CreateICmpSGE(Left, Right);
+      case Condition::lessequal:
+        return Builder.CreateICmpSLE(Left, Right);
+      case Condition::equalequal:
+        return Builder.CreateICmpEQ(Left, Right);
+      case Condition::notequal:
+        return Builder.CreateICmpNE(Left, Right);
       }
-      else
+      llvm_unreachable("unknown comparison");
+    }
+
+    Value *visitC(C &Node)
+    {
+      Value *Left = visit(Node.getLeft());
+      Value *Right = visit(Node.getRight());
+      if (Node.getLOp() == C::KW_and)
+        return Builder.CreateAnd(Left, Right);
+      return Builder.CreateOr(Left, Right);
+    }
+
+    // Each arm tests its condition and falls through to the next arm, every
+    // taken arm branches to the common merge block. Every arm starts from the
+    // values before the if, the merge block gets a phi for each variable
+    // that leaves the arms with different values.
+    Value *visitIf(If &Node)
+    {
+      LLVMContext &Ctx = M->getContext();
+      BasicBlock *MergeBB = BasicBlock::Create(Ctx, "if.end");
+
+      VarList Assigned;
+      collectAssigned(Node.getEquations(), Assigned);
+      for (Elif *E : Node.getElifs())
+        collectAssigned(E->getEquations(), Assigned);
+      if (Else *E = Node.getElsestate())
+        collectAssigned(E->getEquations(), Assigned);
+      unique(Assigned);
+      ValueList Entry, Incoming; // Incoming holds the values of Assigned at the end of each arm
+      SmallVector<BasicBlock *, 4> Preds;
+      save(Assigned, Entry);
+      auto EndArm = [&]() {
+        Builder.CreateBr(MergeBB);
+        Preds.push_back(Builder.GetInsertBlock());
+        for (uint32_t Var : Assigned)
+          Incoming.push_back(Vars[Var]);
+        restore(Assigned, Entry);
+      };
+
+      BasicBlock *ThenBB = BasicBlock::Create(Ctx, "if.then", MainFn);
+      BasicBlock *NextBB = BasicBlock::Create(Ctx, "if.else", MainFn);
+      Builder.CreateCondBr(visit(Node.getConditions()), ThenBB, NextBB);
+      Builder.SetInsertPoint(ThenBB);
+      emitEquations(Node.getEquations());
+      EndArm();
+
+      for (Elif *E : Node.getElifs())
       {
-        // If the factor is a literal, convert it to an integer and create a constant.
-        int intval;
-        Node.getVal().getAsInteger(10, intval);
-        V = ConstantInt::get(Int32Ty, intval, true);
+        Builder.SetInsertPoint(NextBB);
+        ThenBB = BasicBlock::Create(Ctx, "elif.then", MainFn);
+        NextBB = BasicBlock::Create(Ctx, "elif.else", MainFn);
+        Builder.CreateCondBr(visit(E->getConditions()), ThenBB, NextBB);
+        Builder.SetInsertPoint(ThenBB);
+        emitEquations(E->getEquations());
+        EndArm();
       }
-    };
-
-virtual void visit(BinaryOp &Node) override {
-    // Visit the left-hand side of the binary operation and get its value.
-    Node.getLeft()->accept(*this);
-    Value *Left = V;
-
-    // Visit the right-hand side of the binary operation and get its value.
-    Node.getRight()->accept(*this);
-    Value *Right = V;
-
-    // Perform the binary operation based on the operator type and create the corresponding instruction.
-    switch (Node.getOperator()) {
-        case BinaryOp::Plus:{
-            V = Builder.CreateNSWAdd(Left, Right);
-            break;
-        }
-        case BinaryOp::Minus:{
-            V = Builder.CreateNSWSub(Left, Right);
-            break;
-        }
-        case BinaryOp::Mul:{
-            V = Builder.CreateNSWMul(Left, Right);
-            break;
-        }
-        case BinaryOp::Div:{
-            V = Builder.CreateSDiv(Left, Right);
-            break;
-        }
-        case BinaryOp::Mod:{
-            V = Builder.CreateSRem(Left, Right);
-            break;
-        }
-        case BinaryOp::Pow:{
-          int rightValue = 0;
-          Final * right = (Final*) Node.getRight();
-          Value * left = Node.getLeft();
-          right.getVal().getAsInteger(10, rightValue);
-          llvm::errs()<<rightValue<<"\n";
-          Value *LeftVal = Left;
-          if(rightValue == 0){
-            V = ConstantInt::get(Int32Ty, 1, true);
-          }else{
-            for(int i = 0; i < rightValue; i++){
-              V = Builder.CreateNSWMul(Left, LeftVal);
-            }
-            V = Left;
-          }
+
+      Builder.SetInsertPoint(NextBB);
+      if (Else *E = Node.getElsestate())
+        emitEquations(E->getEquations());
+      EndArm();
+
+      MergeBB->insertInto(MainFn);
+      Builder.SetInsertPoint(MergeBB);
+      size_t N = Assigned.size();
+      for (size_t I = 0; I < N; ++I)
+      {
+        bool Same = true;
+        for (size_t K = 1; K < Preds.size(); ++K)
+          Same &= Incoming[K * N + I] == Incoming[I];
+        if (Same)
+        {
+          Vars[Assigned[I]] = Incoming[I];
+          continue;
         }
+        PHINode *Phi = Builder.CreatePHI(Int32Ty, Preds.size(), Symbols.getName(Assigned[I]));
+        for (size_t K = 0; K < Preds.size(); ++K)
+          Phi->addIncoming(Incoming[K * N + I], Preds[K]);
+        Vars[Assigned[I]] = Phi;
+      }
+      return nullptr;
     }
-  }
 
-virtual void visit(Loop& Node) override
-  {
-    llvm::BasicBlock* WhileCondBB = llvm::BasicBlock::Create(M->getContext(), "loopc.cond", MainFn);
-    llvm::BasicBlock* WhileBodyBB = llvm::BasicBlock::Create(M->getContext(), "loopc.body", MainFn);
-    llvm::BasicBlock* AfterWhileBB = llvm::BasicBlock::Create(M->getContext(), "after.loopc", MainFn);
-
-    Builder.CreateBr(WhileCondBB);
-    Builder.SetInsertPoint(WhileCondBB);
-    Node.getConditions()->accept(*this);
-    Value* val = V;
-    Builder.CreateCondBr(val, WhileBodyBB, AfterWhileBB);
-    Builder.SetInsertPoint(WhileBodyBB);
-    llvm::SmallVector<Equation* > equations = Node.getEquations();
-    for (auto i : equations)
+    // The condition block gets a phi for each variable the body assigns,
+    // completed with the values at the end of the body once it is emitted.
+    // Leaving the loop, the variables have their values at the condition.
+    Value *visitLoop(::Loop &Node)
+    {
+      LLVMContext &Ctx = M->getContext();
+      BasicBlock *CondBB = BasicBlock::Create(Ctx, "loopc.cond", MainFn);
+      BasicBlock *BodyBB = BasicBlock::Create(Ctx, "loopc.body", MainFn);
+      BasicBlock *AfterBB = BasicBlock::Create(Ctx, "loopc.end", MainFn);
+
+      VarList Assigned;
+      collectAssigned(Node.getEquations(), Assigned);
+      unique(Assigned);
+
+      BasicBlock *EntryBB = Builder.GetInsertBlock();
+      Builder.CreateBr(CondBB);
+      Builder.SetInsertPoint(CondBB);
+      SmallVector<PHINode *, 8> Phis;
+      for (uint32_t Var : Assigned)
       {
-          (*i)->accept(*this);
+        PHINode *Phi = Builder.CreatePHI(Int32Ty, 2, Symbols.getName(Var));
+        Phi->addIncoming(Vars[Var], EntryBB);
+        Vars[Var] = Phi;
+        Phis.push_back(Phi);
       }
-    Builder.CreateBr(WhileCondBB);
-    Builder.SetInsertPoint(AfterWhileBB);
+      Builder.CreateCondBr(visit(Node.getConditions()), BodyBB, AfterBB);
+      Builder.SetInsertPoint(BodyBB);
+      emitEquations(Node.getEquations());
+      BasicBlock *LatchBB = Builder.GetInsertBlock();
+      Builder.CreateBr(CondBB);
+
+      for (size_t I = 0; I < Assigned.size(); ++I)
+      {
+        Phis[I]->addIncoming(Vars[Assigned[I]], LatchBB);
+        Vars[Assigned[I]] = Phis[I];
+      }
+      // Removing a phi may remove others of the list, the handles in Vars
+      // tell which are left.
+      for (uint32_t Var : Assigned)
+        if (PHINode *Phi = dyn_cast<PHINode>(Vars[Var]))
+          if (Phi->getParent() == CondBB)
+            removeTrivialPhi(Phi);
+      Builder.SetInsertPoint(AfterBB);
+      return nullptr;
+    }
+  };
+} // namespace
+
+// Run the custom pipeline if there is one, else the default pipeline of the
+// level. Nothing runs at -O0. With a target machine the passes use its cost
+// model.
+static bool optimize(Module &M, TargetMachine *TM, unsigned OptLevel, unsigned SizeLevel,
+                     StringRef Passes)
+{
+  if (Passes.empty() && OptLevel == 0 && SizeLevel == 0)
+    return true;
+
+  LoopAnalysisManager LAM;
+  FunctionAnalysisManager FAM;
+  CGSCCAnalysisManager CGAM;
+  ModuleAnalysisManager MAM;
+  PassBuilder PB(TM);
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  ModulePassManager MPM;
+  if (!Passes.empty())
+  {
+    if (Error Err = PB.parsePassPipeline(MPM, Passes))
+    {
+      errs() << "Invalid pass pipeline: " << toString(std::move(Err)) << "\n";
+      return false;
+    }
+  }
+  else
+  {
+    static const OptimizationLevel Levels[] = {OptimizationLevel::O0, OptimizationLevel::O1,
+                                               OptimizationLevel::O2, OptimizationLevel::O3};
+    OptimizationLevel Level = Levels[OptLevel];
+    if (SizeLevel)
+      Level = SizeLevel == 1 ? OptimizationLevel::Os : OptimizationLevel::Oz;
+    MPM = PB.buildPerModuleDefaultPipeline(Level);
   }
+  MPM.run(M, MAM);
+  return true;
+}
 
-virtual void visit(If &Node) override {
-    Node.getConditions()->accept(*this);
-    Value *ifCondValue = V;
+// Generate the module of the program, verify it if asked and return null
+// if it is broken. The caller sets the target and optimizes it.
+std::unique_ptr<Module> CodeGen::generate(AST *Tree, const SymbolTable &Symbols, LLVMContext &Ctx)
+{
+  std::unique_ptr<Module> M = std::make_unique<Module>("main.expr", Ctx);
 
-    llvm::Function *TheFunction = Builder.GetInsertBlock()->getParent();
+  // Create an instance of the ToIRVisitor and run it on the AST to generate LLVM IR.
+  ToIRVisitor ToIR(M.get(), Symbols);
+  ToIR.run(Tree);
 
-    llvm::BasicBlock *ThenBB = llvm::BasicBlock::Create(Context, "then", TheFunction);
-    llvm::BasicBlock *ElseBB = llvm::BasicBlock::Create(Context, "else");
-    llvm::BasicBlock *MergeBB = llvm::BasicBlock::Create(Context, "merge");
+  // A broken module would only crash the passes, report it instead.
+  if (Verify && verifyModule(*M, &errs()))
+  {
+    errs() << "Generated module is broken\n";
+    return nullptr;
+  }
+  return M;
+}
 
-    Builder.CreateCondBr(ifCondValue, ThenBB, ElseBB);
+CodeGen::CodeGen() : OptLevel(0), SizeLevel(0), Verify(false), Emit(EmitLL), Output("-"), NumLoops(0) {}
 
-    Builder.SetInsertPoint(ThenBB);
+CodeGen::~CodeGen() = default;
 
-    llvm::SmallVector<Equation *> equations = Node.getEquations();
-    for (auto *equation : equations) {
-        equation->accept(*this);
-    }
+std::string CodeGen::getCPUName() const
+{
+  return CPU == "native" ? sys::getHostCPUName().str() : CPU;
+}
+
+SubtargetFeatures CodeGen::getFeatures() const
+{
+  SubtargetFeatures Result;
+  if (CPU == "native")
+  {
+    StringMap<bool> HostFeatures;
+    if (sys::getHostCPUFeatures(HostFeatures))
+      for (const StringMapEntry<bool> &F : HostFeatures)
+        Result.AddFeature(F.first(), F.second);
+  }
+  SmallVector<StringRef, 8> Attrs;
+  StringRef(Features).split(Attrs, ',', -1, /*KeepEmpty=*/false);
+  for (StringRef Attr : Attrs)
+    Result.AddFeature(Attr.trim());
+  return Result;
+}
 
-    Builder.CreateBr(MergeBB);
-    ThenBB = Builder.GetInsertBlock(); 
-    TheFunction->getBasicBlockList().push_back(ElseBB);
-    Builder.SetInsertPoint(ElseBB);
+std::unique_ptr<TargetMachine> CodeGen::createTargetMachine() const
+{
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
 
-    llvm::SmallVector<Elif *> elifs = Node.getElifs();
-    for (auto *elif : elifs) {
-        elif->accept(*this);
-    }
+  std::string Triple = sys::getDefaultTargetTriple();
+  std::string Error;
+  const Target *T = TargetRegistry::lookupTarget(Triple, Error);
+  if (!T)
+  {
+    errs() << "Unknown target " << Triple << ": " << Error << "\n";
+    return nullptr;
+  }
+  static const CodeGenOpt::Level Levels[] = {CodeGenOpt::None, CodeGenOpt::Less,
+                                             CodeGenOpt::Default, CodeGenOpt::Aggressive};
+  // The object files are linked with rtmain.c into position independent
+  // executables by default.
+  return std::unique_ptr<TargetMachine>(T->createTargetMachine(
+      Triple, getCPUName(), getFeatures().getString(), TargetOptions(), Reloc::PIC_, None,
+      Levels[OptLevel]));
+}
+
+std::string CodeGen::getCacheKey() const
+{
+  std::string Key;
+  raw_string_ostream OS(Key);
+  OS << "gsm " << Version << " llvm " << LLVM_VERSION_STRING << " triple "
+     << sys::getDefaultTargetTriple() << " cpu " << getCPUName() << " features "
+     << getFeatures().getString() << " O" << OptLevel << " s" << SizeLevel << " emit " << Emit
+     << " passes " << Passes;
+  return OS.str();
+}
 
-    Builder.CreateBr(MergeBB);
-    ElseBB = Builder.GetInsertBlock(); 
-    TheFunction->getBasicBlockList().push_back(MergeBB);
-    Builder.SetInsertPoint(MergeBB);
+bool CodeGen::compile(AST *Tree, const SymbolTable &Symbols)
+{
+  SmallString<0> Result;
+  return compile(Tree, Symbols, Result) && write(Result);
+}
 
-    Else *elseState = Node.getElsestate();
-    if (elseState) {
-        elseState->accept(*this);
+bool CodeGen::write(StringRef Data) const
+{
+  std::error_code EC;
+  ToolOutputFile Out(Output, EC, Emit == EmitLL || Emit == EmitAsm ? sys::fs::OF_Text : sys::fs::OF_None);
+  if (EC)
+  {
+    errs() << "Could not open " << Output << ": " << EC.message() << "\n";
+    return false;
+  }
+  Out.os() << Data;
+  Out.keep();
+  return true;
+}
+
+bool CodeGen::compile(AST *Tree, const SymbolTable &Symbols, SmallVectorImpl<char> &Result)
+{
+  // Create an LLVM context and a module.
+  LLVMContext Ctx;
+  std::unique_ptr<Module> M = generate(Tree, Symbols, Ctx);
+  if (!M)
+    return false;
+
+  // Textual IR and bitcode stay target independent unless a target is asked
+  // for. A targeted module records the CPU and features on its functions,
+  // so the tools reading it generate the same code.
+  std::unique_ptr<TargetMachine> TM;
+  if (Emit == EmitAsm || Emit == EmitObj || !CPU.empty() || !Features.empty())
+  {
+    TM = createTargetMachine();
+    if (!TM)
+      return false;
+    M->setDataLayout(TM->createDataLayout());
+    M->setTargetTriple(TM->getTargetTriple().str());
+    for (Function &F : *M)
+    {
+      if (F.isDeclaration())
+        continue;
+      if (!TM->getTargetCPU().empty())
+        F.addFnAttr("target-cpu", TM->getTargetCPU());
+      if (!TM->getTargetFeatureString().empty())
+        F.addFnAttr("target-features", TM->getTargetFeatureString());
     }
   }
 
+  if (!optimize(*M, TM.get(), OptLevel, SizeLevel, Passes))
+    return false;
 
-  virtual void visit(Declaration &Node) override
+  raw_svector_ostream OS(Result);
+  switch (Emit)
+  {
+  case EmitLL:
+    M->print(OS, nullptr);
+    break;
+  case EmitBC:
+    WriteBitcodeToFile(*M, OS);
+    break;
+  case EmitAsm:
+  case EmitObj:
+  {
+    legacy::PassManager CodeGenPasses;
+    CodeGenFileType FileType = Emit == EmitAsm ? CGFT_AssemblyFile : CGFT_ObjectFile;
+    if (TM->addPassesToEmitFile(CodeGenPasses, OS, nullptr, FileType))
     {
-      Value *val = nullptr;
+      errs() << "The target cannot emit this file type\n";
+      return false;
+    }
+    CodeGenPasses.run(*M);
+    break;
+  }
+  }
+  return true;
+}
 
-      if (Node.getExpr())
-      {
-        // If there is an expression provided, visit it and get its value.
-        Node.getExpr()->accept(*this);
-        val = V;
-      }
+// The JIT compiles for the host and links main_write and main_read to the
+// implementations in the compiler itself.
+bool CodeGen::createJIT(std::unique_ptr<orc::LLJIT> &JIT, std::unique_ptr<TargetMachine> &TM) const
+{
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
 
-      // Iterate over the variables declared in the declaration statement.
-      for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
-      {
-        StringRef Var = *I;
+  Expected<orc::JITTargetMachineBuilder> JTMB = orc::JITTargetMachineBuilder::detectHost();
+  if (!JTMB)
+  {
+    errs() << "Could not detect the host: " << toString(JTMB.takeError()) << "\n";
+    return false;
+  }
+  if (!CPU.empty())
+    JTMB->setCPU(getCPUName());
+  JTMB->addFeatures(getFeatures().getFeatures());
+  Expected<std::unique_ptr<TargetMachine>> Machine = JTMB->createTargetMachine();
+  if (!Machine)
+  {
+    errs() << "Could not create the target machine: " << toString(Machine.takeError()) << "\n";
+    return false;
+  }
 
-        // Create an alloca instruction to allocate memory for the variable.
-        nameMap[Var] = Builder.CreateAlloca(Int32Ty);
+  Expected<std::unique_ptr<orc::LLJIT>> Created =
+      orc::LLJITBuilder().setJITTargetMachineBuilder(std::move(*JTMB)).create();
+  if (!Created)
+  {
+    errs() << "Could not create the JIT: " << toString(Created.takeError()) << "\n";
+    return false;
+  }
 
-        // Store the initial value (if any) in the variable's memory location.
-        if (val != nullptr)
-        {
-          Builder.CreateStore(val, nameMap[Var]);
-        }
-      }
-    };
-
-virtual void visit(C &Node) override {
-    if (Node.getLeft() && Node.getRight()) {
-        Node.getLeft()->accept(*this);
-        Value *LeftValue = V; 
-        Node.getRight()->accept(*this);
-        Value *RightValue = V; 
-        switch (Node.getLOp()) {
-            case C::And:
-                // Perform logical AND operation.
-                V = Builder.CreateAnd(LeftValue, RightValue);
-                break;
-            case C::Or:
-                // Perform logical OR operation.
-                V = Builder.CreateOr(LeftValue, RightValue);
-                break;
-        }
-      }
-    }
-  };
-}; // namespace
+  orc::MangleAndInterner Mangle((*Created)->getExecutionSession(), (*Created)->getDataLayout());
+  orc::SymbolMap Runtime;
+  Runtime[Mangle("main_write")] =
+      JITEvaluatedSymbol(pointerToJITTargetAddress(&runtime::write), JITSymbolFlags::Exported);
+  Runtime[Mangle("main_read")] =
+      JITEvaluatedSymbol(pointerToJITTargetAddress(&runtime::read), JITSymbolFlags::Exported);
+  if (Error Err = (*Created)->getMainJITDylib().define(orc::absoluteSymbols(std::move(Runtime))))
+  {
+    errs() << "Could not define the runtime: " << toString(std::move(Err)) << "\n";
+    return false;
+  }
+  JIT = std::move(*Created);
+  TM = std::move(*Machine);
+  return true;
+}
 
-void CodeGen::compile(AST *Tree)
+// The passes see the layout the code is compiled for. Returns the address
+// of the function Name, null on failure.
+void *CodeGen::addToJIT(orc::LLJIT &JIT, TargetMachine &TM, std::unique_ptr<Module> M,
+                        std::unique_ptr<LLVMContext> Ctx, StringRef Name)
 {
-  // Create an LLVM context and a module.
-  LLVMContext Ctx;
-  Module *M = new Module("main.expr", Ctx);
+  M->setDataLayout(JIT.getDataLayout());
+  M->setTargetTriple(JIT.getTargetTriple().str());
+  if (!optimize(*M, &TM, OptLevel, SizeLevel, Passes))
+    return nullptr;
 
-  // Create an instance of the ToIRVisitor and run it on the AST to generate LLVM IR.
-  ToIRVisitor ToIR(M);
-  ToIR.run(Tree);
+  if (Error Err = JIT.addIRModule(orc::ThreadSafeModule(std::move(M), std::move(Ctx))))
+  {
+    errs() << "Could not add the module to the JIT: " << toString(std::move(Err)) << "\n";
+    return nullptr;
+  }
+  Expected<JITEvaluatedSymbol> Sym = JIT.lookup(Name);
+  if (!Sym)
+  {
+    errs() << "Could not compile " << Name << ": " << toString(Sym.takeError()) << "\n";
+    return nullptr;
+  }
+  return jitTargetAddressToPointer<void *>(Sym->getAddress());
+}
+
+bool CodeGen::run(AST *Tree, const SymbolTable &Symbols, int &ExitCode)
+{
+  std::unique_ptr<orc::LLJIT> JIT;
+  std::unique_ptr<TargetMachine> TM;
+  if (!createJIT(JIT, TM))
+    return false;
+
+  auto Ctx = std::make_unique<LLVMContext>();
+  std::unique_ptr<Module> M = generate(Tree, Symbols, *Ctx);
+  if (!M)
+    return false;
+  void *Main = addToJIT(*JIT, *TM, std::move(M), std::move(Ctx), "main");
+  if (!Main)
+    return false;
+
+  char Name[] = "main.expr";
+  char *Argv[] = {Name, nullptr};
+  ExitCode = reinterpret_cast<int (*)(int, char **)>(Main)(1, Argv);
+  return true;
+}
 
-  // Print the generated module to the standard output.
-  M->print(outs(), nullptr);
+CodeGen::LoopFn CodeGen::compileLoop(::Loop *Node, const SymbolTable &Symbols, const int32_t *Vars)
+{
+  if (!LoopJIT && !createJIT(LoopJIT, LoopMachine))
+    return nullptr;
+
+  std::string Name = "loop." + std::to_string(NumLoops++);
+  auto Ctx = std::make_unique<LLVMContext>();
+  std::unique_ptr<Module> M = std::make_unique<Module>("main.expr", *Ctx);
+  ToIRVisitor ToIR(M.get(), Symbols);
+  ToIR.runLoop(Node, Name, makeArrayRef(Vars, Symbols.size()));
+  if (Verify && verifyModule(*M, &errs()))
+  {
+    errs() << "Generated module is broken\n";
+    return nullptr;
+  }
+  return reinterpret_cast<LoopFn>(addToJIT(*LoopJIT, *LoopMachine, std::move(M), std::move(Ctx), Name));
 }
@@ -2,11 +2,119 @@
 #define CODEGEN_H
 
 #include "AST.h"
+#include "SymbolTable.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Module.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Target/TargetMachine.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace llvm
+{
+  namespace orc
+  {
+    class LLJIT;
+  } // namespace orc
+} // namespace llvm
 
 class CodeGen
 {
 public:
- void compile(AST *Tree);
+  enum EmitKind
+  {
+    EmitLL,  // Textual IR
+    EmitBC,  // Bitcode
+    EmitAsm, // Assembly for the target
+    EmitObj  // Object file for the target
+  };
+
+private:
+  unsigned OptLevel;    // 0 to 3, the level of the default LLVM pipeline
+  unsigned SizeLevel;   // 1 for -Os, 2 for -Oz, on top of level 2
+  std::string Passes;   // A custom pipeline in the syntax of opt -passes
+  bool Verify;          // Verify the module before running any pass
+  EmitKind Emit;        // What compile() writes
+  std::string Output;   // Where compile() writes it, "-" for stdout
+  std::string CPU;      // The target CPU, "native" for the host
+  std::string Features; // Comma separated target features, as in -mattr=+avx2,-sse4.2
+  unsigned NumLoops;    // Loops compiled by compileLoop, to name them
+
+  // The JIT of compileLoop and its target machine, created on first use.
+  std::unique_ptr<llvm::orc::LLJIT> LoopJIT;
+  std::unique_ptr<llvm::TargetMachine> LoopMachine;
+
+  std::unique_ptr<llvm::Module> generate(AST *Tree, const SymbolTable &Symbols, llvm::LLVMContext &Ctx);
+  std::string getCPUName() const;
+  llvm::SubtargetFeatures getFeatures() const;
+  std::unique_ptr<llvm::TargetMachine> createTargetMachine() const;
+  bool createJIT(std::unique_ptr<llvm::orc::LLJIT> &JIT, std::unique_ptr<llvm::TargetMachine> &TM) const;
+  void *addToJIT(llvm::orc::LLJIT &JIT, llvm::TargetMachine &TM, std::unique_ptr<llvm::Module> M,
+                 std::unique_ptr<llvm::LLVMContext> Ctx, llvm::StringRef Name);
+
+public:
+  // Out of line, the JIT is incomplete here.
+  CodeGen();
+  ~CodeGen();
+
+  void setOptLevel(unsigned Level, unsigned Size = 0)
+  {
+    OptLevel = Level;
+    SizeLevel = Size;
+  }
+
+  // Run Pipeline instead of the default pipeline of the level.
+  void setPasses(llvm::StringRef Pipeline) { Passes = Pipeline.str(); }
+
+  void setVerify(bool Enable) { Verify = Enable; }
+
+  void setEmit(EmitKind Kind) { Emit = Kind; }
+
+  void setOutput(llvm::StringRef Path) { Output = Path.str(); }
+
+  // Generate code for Name, "native" selecting the host CPU and its
+  // features, and with the features in the -mattr syntax on top of those.
+  void setTarget(llvm::StringRef Name, llvm::StringRef Attrs)
+  {
+    CPU = Name.str();
+    Features = Attrs.str();
+  }
+
+  // Bumped whenever the generated code changes, it is part of the cache key.
+  static const unsigned Version = 1;
+
+  // Writes the module, optimized as configured, to the output in the form
+  // selected by setEmit. Assembly and object files, and any module with a
+  // CPU or features set, are compiled for the host triple. Returns false if
+  // it does not verify, the custom pipeline cannot be parsed or the output
+  // cannot be written.
+  bool compile(AST *Tree, const SymbolTable &Symbols);
+
+  // Generates the same output into Result instead of writing it.
+  bool compile(AST *Tree, const SymbolTable &Symbols, llvm::SmallVectorImpl<char> &Result);
+
+  // Writes Data, output of compile, to the output file.
+  bool write(llvm::StringRef Data) const;
+
+  // Everything besides the program the output of compile depends on: the
+  // compiler and LLVM versions, the host triple, the CPU and features, the
+  // optimization and the kind of output.
+  std::string getCacheKey() const;
+
+  // Compiles the module, optimized as configured, with the JIT and calls its
+  // main in this process. ExitCode is what main returned. Returns false if
+  // the module cannot be built or compiled.
+  bool run(AST *Tree, const SymbolTable &Symbols, int &ExitCode);
+
+  // Runs a loop to its end on the variables, indexed by symbol ID.
+  typedef void (*LoopFn)(int32_t *Vars);
 
+  // Compiles Node, optimized as configured, with a JIT kept for all loops.
+  // Every variable is specialized to its value in Vars, the returned code
+  // is valid for this entry into the loop only. Returns null if the loop
+  // cannot be compiled.
+  LoopFn compileLoop(Loop *Node, const SymbolTable &Symbols, const int32_t *Vars);
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,141 @@
+#include "CompileCache.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+  const char Magic[4] = {'G', 'S', 'M', 'O'};
+  const uint32_t Version = 1;
+  const char Extension[] = ".out";
+
+  struct Header
+  {
+    char Magic[4];
+    uint32_t Version;
+    uint64_t SourceSize; // Guards against a hash collision on top of the key
+  };
+} // namespace
+
+std::string CompileCache::getPath(llvm::StringRef Source, llvm::StringRef Key) const
+{
+  llvm::SHA1 Hash;
+  Hash.update(Source);
+  const uint8_t Separator = 0;
+  Hash.update(llvm::makeArrayRef(Separator));
+  Hash.update(Key);
+  llvm::SmallString<128> Path(Dir);
+  llvm::sys::path::append(Path, llvm::toHex(Hash.final(), /*LowerCase=*/true) + Extension);
+  return std::string(Path.str());
+}
+
+bool CompileCache::load(llvm::StringRef Source, llvm::StringRef Key, llvm::SmallVectorImpl<char> &Output)
+{
+  std::string Path = getPath(Source, Key);
+  int FD;
+  if (llvm::sys::fs::openFileForRead(Path, FD))
+    return false;
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> BufOrErr =
+      llvm::MemoryBuffer::getOpenFile(FD, Path, /*FileSize=*/-1, /*RequiresNullTerminator=*/false);
+  // The entry is now the most recently used one.
+  llvm::sys::fs::setLastAccessAndModificationTime(FD, std::chrono::system_clock::now());
+  llvm::sys::Process::SafelyCloseFileDescriptor(FD);
+  if (!BufOrErr)
+    return false;
+  llvm::StringRef Buf = (*BufOrErr)->getBuffer();
+  Header H;
+  if (Buf.size() < sizeof(Header))
+    return false;
+  std::memcpy(&H, Buf.data(), sizeof(Header));
+  if (std::memcmp(H.Magic, Magic, sizeof(Magic)) || H.Version != Version ||
+      H.SourceSize != Source.size())
+    return false;
+  Output.assign(Buf.begin() + sizeof(Header), Buf.end());
+  return true;
+}
+
+void CompileCache::store(llvm::StringRef Source, llvm::StringRef Key, llvm::StringRef Output)
+{
+  if (std::error_code EC = llvm::sys::fs::create_directories(Dir))
+  {
+    llvm::errs() << "Could not create compile cache " << Dir << ": " << EC.message() << "\n";
+    return;
+  }
+  Header H;
+  std::memcpy(H.Magic, Magic, sizeof(Magic));
+  H.Version = Version;
+  H.SourceSize = Source.size();
+
+  // Write to a unique temporary and rename it into place, as ASTCache does.
+  std::string Path = getPath(Source, Key);
+  llvm::SmallString<128> TempPath;
+  int FD;
+  if (std::error_code EC = llvm::sys::fs::createUniqueFile(Path + ".tmp%%%%%%", FD, TempPath))
+  {
+    llvm::errs() << "Could not write compile cache entry " << Path << ": " << EC.message() << "\n";
+    return;
+  }
+  llvm::raw_fd_ostream OS(FD, /*shouldClose=*/true);
+  OS.write(reinterpret_cast<const char *>(&H), sizeof(Header));
+  OS << Output;
+  OS.close();
+  std::error_code EC = OS.error();
+  if (EC)
+    OS.clear_error();
+  else
+    EC = llvm::sys::fs::rename(TempPath, Path);
+  if (EC)
+  {
+    llvm::errs() << "Could not write compile cache entry " << Path << ": " << EC.message() << "\n";
+    llvm::sys::fs::remove(TempPath);
+    return;
+  }
+  prune();
+}
+
+// Oldest first, entries go until the rest fits. Another compiler may prune
+// at the same time, an entry that is already gone is skipped.
+void CompileCache::prune()
+{
+  if (!Limit)
+    return;
+  struct Entry
+  {
+    std::string Path;
+    uint64_t Size;
+    llvm::sys::TimePoint<> Used;
+  };
+  std::vector<Entry> Entries;
+  uint64_t Total = 0;
+  std::error_code EC;
+  for (llvm::sys::fs::directory_iterator I(Dir, EC), E; I != E && !EC; I.increment(EC))
+  {
+    if (!llvm::StringRef(I->path()).endswith(Extension))
+      continue;
+    llvm::sys::fs::file_status Status;
+    if (llvm::sys::fs::status(I->path(), Status))
+      continue;
+    Entries.push_back({I->path(), Status.getSize(), Status.getLastModificationTime()});
+    Total += Status.getSize();
+  }
+  if (Total <= Limit)
+    return;
+  std::sort(Entries.begin(), Entries.end(),
+            [](const Entry &A, const Entry &B) { return A.Used < B.Used; });
+  for (const Entry &Victim : Entries)
+  {
+    if (Total <= Limit)
+      break;
+    llvm::sys::fs::remove(Victim.Path);
+    Total -= Victim.Size;
+  }
+}
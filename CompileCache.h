@@ -0,0 +1,37 @@
+#ifndef COMPILECACHE_H
+#define COMPILECACHE_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <string>
+
+// On-disk cache of compiler output, keyed by the SHA-1 of the source and of
+// everything else the output depends on. A hit returns the stored object,
+// assembly, bitcode or IR without running any part of the compiler.
+//
+// Entries are written to a unique temporary and renamed into place, so
+// concurrent compilers sharing the directory never see a partial one. A hit
+// touches the entry's modification time, and after every store the least
+// recently used entries are removed until the cache fits in its limit.
+//
+// Entry layout: Header, then the output.
+class CompileCache
+{
+  std::string Dir;
+  uint64_t Limit; // Bytes, 0 for no limit
+
+  std::string getPath(llvm::StringRef Source, llvm::StringRef Key) const;
+  void prune();
+
+public:
+  CompileCache(llvm::StringRef Dir, uint64_t Limit) : Dir(Dir.str()), Limit(Limit) {}
+
+  // Returns false on a miss or an unusable entry.
+  bool load(llvm::StringRef Source, llvm::StringRef Key, llvm::SmallVectorImpl<char> &Output);
+
+  // Add an output. Failures are reported and otherwise ignored.
+  void store(llvm::StringRef Source, llvm::StringRef Key, llvm::StringRef Output);
+};
+
+#endif
@@ -0,0 +1,140 @@
+#include "FlatAST.h"
+#include "StaticVisitor.h"
+
+// Emits the nodes of the pointer AST in post-order into a FlatAST.
+class FlatASTBuilder : public StaticVisitor<FlatASTBuilder>
+{
+  FlatAST &Flat;
+
+  uint32_t start() { return Flat.size(); }
+
+  // Append a node whose children were emitted since Start.
+  void emit(FlatAST::NodeKind Kind, uint32_t Data, uint32_t Start)
+  {
+    Flat.Kinds.push_back(Kind);
+    Flat.Data.push_back(Data);
+    Flat.Sizes.push_back(Flat.size() - Start);
+  }
+
+  void emitEquations(llvm::ArrayRef<Equation *> Equations)
+  {
+    for (Equation *Eq : Equations)
+      visit(Eq);
+  }
+
+public:
+  FlatASTBuilder(FlatAST &Flat) : Flat(Flat) {}
+
+  void visitGoal(Goal &Node)
+  {
+    uint32_t Start = start();
+    for (Statement *S : Node.getStatements())
+      visit(S);
+    emit(FlatAST::Goal, Node.getStatements().size(), Start);
+  }
+
+  void visitFinal(Final &Node)
+  {
+    if (Node.getKind() == Final::Id)
+      emit(FlatAST::Id, Node.getSymbol(), start());
+    else
+      emit(FlatAST::Num, (uint32_t)Node.getNumber(), start());
+  }
+
+  void visitBinaryOp(BinaryOp &Node)
+  {
+    static const FlatAST::NodeKind Kinds[] = {FlatAST::Add, FlatAST::Sub, FlatAST::Mul,
+                                              FlatAST::Div, FlatAST::Rem, FlatAST::Pow};
+    uint32_t Start = start();
+    visit(Node.getLeft());
+    visit(Node.getRight());
+    emit(Kinds[Node.getOperator()], 0, Start);
+  }
+
+  void visitCondition(Condition &Node)
+  {
+    static const FlatAST::NodeKind Kinds[] = {FlatAST::Greater, FlatAST::Less,
+                                              FlatAST::GreaterEqual, FlatAST::LessEqual,
+                                              FlatAST::EqualEqual, FlatAST::NotEqual};
+    uint32_t Start = start();
+    visit(Node.getLeft());
+    visit(Node.getRight());
+    emit(Kinds[Node.getOpC()], 0, Start);
+  }
+
+  void visitC(C &Node)
+  {
+    uint32_t Start = start();
+    visit(Node.getLeft());
+    visit(Node.getRight());
+    emit(Node.getLOp() == C::KW_and ? FlatAST::And : FlatAST::Or, 0, Start);
+  }
+
+  // A declaration becomes one Declare node per variable, the I-th variable
+  // owning the I-th initializer if there is one.
+  void visitDeclaration(Declaration &Node)
+  {
+    llvm::ArrayRef<uint32_t> Vars = Node.getVars();
+    llvm::ArrayRef<Expr *> Exprs = Node.getExprs();
+    for (size_t I = 0; I < Vars.size(); ++I)
+    {
+      uint32_t Start = start();
+      if (I < Exprs.size())
+        visit(Exprs[I]);
+      emit(FlatAST::Declare, Vars[I], Start);
+    }
+  }
+
+  void visitEquation(Equation &Node)
+  {
+    static const FlatAST::NodeKind Kinds[] = {FlatAST::Assign, FlatAST::AddAssign,
+                                              FlatAST::SubAssign, FlatAST::MulAssign,
+                                              FlatAST::DivAssign, FlatAST::RemAssign};
+    uint32_t Start = start();
+    visit(Node.getE());
+    emit(Kinds[Node.getOp()], Node.getId()->getSymbol(), Start);
+  }
+
+  void visitIf(If &Node)
+  {
+    uint32_t Start = start();
+    visit(Node.getConditions());
+    emitEquations(Node.getEquations());
+    for (Elif *E : Node.getElifs())
+      visit(E);
+    if (Node.getElsestate())
+      visit(Node.getElsestate());
+    emit(FlatAST::If, Node.getEquations().size(), Start);
+  }
+
+  void visitElif(Elif &Node)
+  {
+    uint32_t Start = start();
+    visit(Node.getConditions());
+    emitEquations(Node.getEquations());
+    emit(FlatAST::ElifArm, Node.getEquations().size(), Start);
+  }
+
+  void visitElse(Else &Node)
+  {
+    uint32_t Start = start();
+    emitEquations(Node.getEquations());
+    emit(FlatAST::ElseArm, Node.getEquations().size(), Start);
+  }
+
+  void visitLoop(Loop &Node)
+  {
+    uint32_t Start = start();
+    visit(Node.getConditions());
+    emitEquations(Node.getEquations());
+    emit(FlatAST::Loop, Node.getEquations().size(), Start);
+  }
+};
+
+FlatAST FlatAST::flatten(AST *Tree)
+{
+  FlatAST Flat;
+  FlatASTBuilder Builder(Flat);
+  Builder.visit(Tree);
+  return Flat;
+}
@@ -0,0 +1,90 @@
+#ifndef FLATAST_H
+#define FLATAST_H
+
+#include "AST.h"
+#include "llvm/ADT/ArrayRef.h"
+#include <cstdint>
+#include <vector>
+
+// FlatAST is a compact copy of the AST for whole-program walks. Nodes live in
+// parallel arrays and are referred to by 32-bit index. They are laid out in
+// post-order, so every subtree is a contiguous range ending at its root, the
+// size array gives its length, and the root is the last node. Expressions
+// and conditions can be evaluated by a single forward loop with an operand
+// stack.
+class FlatAST
+{
+public:
+  enum NodeKind : uint8_t
+  {
+    // Leaves, Data is the literal value or the symbol ID.
+    Num,
+    Id,
+    // Binary expressions, children: left, right.
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Rem,
+    Pow,
+    // Comparisons, children: left, right expression.
+    Greater,
+    Less,
+    GreaterEqual,
+    LessEqual,
+    EqualEqual,
+    NotEqual,
+    // Logic, children: left, right condition.
+    And,
+    Or,
+    // One declared variable, Data is the symbol ID, optional child: initializer.
+    Declare,
+    // Assignments, Data is the symbol ID of the target, child: value.
+    Assign,
+    AddAssign,
+    SubAssign,
+    MulAssign,
+    DivAssign,
+    RemAssign,
+    // Children: condition, Data statements, then ElifArm*, optional ElseArm.
+    If,
+    // Children: condition, statements.
+    ElifArm,
+    // Children: statements.
+    ElseArm,
+    // Children: condition, statements.
+    Loop,
+    // Children: statements, Data is their count.
+    Goal
+  };
+
+private:
+  std::vector<uint8_t> Kinds;
+  std::vector<uint32_t> Data;
+  std::vector<uint32_t> Sizes; // Number of nodes in the subtree rooted here
+
+  friend class FlatASTBuilder;
+
+public:
+  // Build the flat form of a parsed program.
+  static FlatAST flatten(AST *Tree);
+
+  uint32_t size() const { return Kinds.size(); }
+  uint32_t getRoot() const { return Kinds.size() - 1; }
+
+  NodeKind getKind(uint32_t N) const { return (NodeKind)Kinds[N]; }
+  uint32_t getData(uint32_t N) const { return Data[N]; }
+
+  // The node arrays, for writing them out.
+  llvm::ArrayRef<uint8_t> getKinds() const { return Kinds; }
+  llvm::ArrayRef<uint32_t> getData() const { return Data; }
+  llvm::ArrayRef<uint32_t> getSizes() const { return Sizes; }
+
+  size_t getMemory() const
+  {
+    return Kinds.capacity() * sizeof(uint8_t) + Data.capacity() * sizeof(uint32_t) +
+           Sizes.capacity() * sizeof(uint32_t);
+  }
+};
+
+#endif
@@ -0,0 +1,384 @@
+#include "Incremental.h"
+#include "ParallelParser.h"
+#include "parser.h"
+#include "Sema.h"
+#include "StaticVisitor.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Casting.h"
+#include <algorithm>
+#include <string>
+
+namespace {
+llvm::ArrayRef<uint32_t> declaredVars(Statement *S)
+{
+    if (Declaration *D = llvm::dyn_cast<Declaration>(S))
+        return D->getVars();
+    return llvm::ArrayRef<uint32_t>();
+}
+
+// An elif or else arm continues the if statement in front of it.
+bool startsWithArm(llvm::StringRef Text)
+{
+    Text = Text.ltrim();
+    llvm::StringRef Word = Text.take_while(llvm::isAlnum);
+    return Word == "elif" || Word == "else";
+}
+
+// Copies a tree into another context. The copy starts without any of the
+// annotations the passes add. When the tree moves to a new symbol table as
+// well, its symbols are interned there again and the source texts of its
+// leaves are rebased from each statement's old text onto its new one.
+class ASTCloner : public StaticVisitor<ASTCloner, AST *>
+{
+    ASTContext &Context;
+    const SymbolTable *From = nullptr;
+    SymbolTable *To = nullptr;
+    std::vector<uint32_t> Remap; // Per old symbol, its new ID
+    llvm::StringRef OldText, NewText;
+
+    uint32_t mapSymbol(uint32_t Sym)
+    {
+        if (!To)
+            return Sym;
+        if (Remap[Sym] == SymbolTable::NotFound)
+            Remap[Sym] = To->intern(From->getName(Sym));
+        return Remap[Sym];
+    }
+    llvm::StringRef mapText(llvm::StringRef Val)
+    {
+        if (!To)
+            return Val;
+        assert(Val.begin() >= OldText.begin() && Val.end() <= OldText.end() &&
+               "leaf text outside of its statement");
+        return llvm::StringRef(NewText.data() + (Val.data() - OldText.data()), Val.size());
+    }
+
+    template <typename T> T *clone(T *Node) { return llvm::cast<T>(visit(Node)); }
+    template <typename T> llvm::ArrayRef<T *> clone(llvm::ArrayRef<T *> Nodes)
+    {
+        llvm::SmallVector<T *, 8> Copies;
+        for (T *Node : Nodes)
+            Copies.push_back(clone(Node));
+        return Context.copy(Copies);
+    }
+
+    public:
+    ASTCloner(ASTContext &Context) : Context(Context) {}
+    ASTCloner(ASTContext &Context, const SymbolTable &From, SymbolTable &To)
+        : Context(Context), From(&From), To(&To), Remap(From.size(), uint32_t(SymbolTable::NotFound)) {}
+
+    // Clone a statement whose source text moved from Old to New.
+    Statement *moveStatement(Statement *S, llvm::StringRef Old, llvm::StringRef New)
+    {
+        OldText = Old;
+        NewText = New;
+        return clone(S);
+    }
+    uint32_t getNewSymbol(uint32_t Sym) const { return Remap[Sym]; }
+
+    AST *visitGoal(Goal &Node) { return Context.create<Goal>(clone(Node.getStatements())); }
+    AST *visitFinal(Final &Node)
+    {
+        return Context.create<Final>(Node.getKind(), mapText(Node.getVal()),
+                                     Node.getKind() == Final::Id ? mapSymbol(Node.getSymbol())
+                                                                 : (uint32_t)Node.getNumber());
+    }
+    AST *visitBinaryOp(BinaryOp &Node)
+    {
+        return Context.create<BinaryOp>(Node.getOperator(), clone(Node.getLeft()), clone(Node.getRight()));
+    }
+    AST *visitDeclaration(Declaration &Node)
+    {
+        if (!To)
+            return Context.create<Declaration>(Node.getVars(), clone(Node.getExprs()));
+        llvm::SmallVector<uint32_t, 8> Vars;
+        for (uint32_t Var : Node.getVars())
+            Vars.push_back(mapSymbol(Var));
+        return Context.create<Declaration>(Context.copy(Vars), clone(Node.getExprs()));
+    }
+    AST *visitEquation(Equation &Node)
+    {
+        return Context.create<Equation>(clone(Node.getId()), clone(Node.getE()), Node.getOp());
+    }
+    AST *visitIf(If &Node)
+    {
+        Else *ElseState = Node.getElsestate() ? clone(Node.getElsestate()) : nullptr;
+        return Context.create<If>(clone(Node.getConditions()), clone(Node.getEquations()),
+                                  clone(Node.getElifs()), ElseState);
+    }
+    AST *visitElif(Elif &Node)
+    {
+        return Context.create<Elif>(clone(Node.getConditions()), clone(Node.getEquations()));
+    }
+    AST *visitElse(Else &Node) { return Context.create<Else>(clone(Node.getEquations())); }
+    AST *visitLoop(Loop &Node)
+    {
+        return Context.create<Loop>(clone(Node.getConditions()), clone(Node.getEquations()));
+    }
+    AST *visitC(C &Node)
+    {
+        return Context.create<C>(clone(Node.getLeft()), clone(Node.getRight()), Node.getLOp());
+    }
+    AST *visitCondition(Condition &Node)
+    {
+        return Context.create<Condition>(clone(Node.getLeft()), clone(Node.getRight()), Node.getOpC());
+    }
+};
+}
+
+const uint32_t IncrementalCompiler::NotDeclared;
+const size_t IncrementalCompiler::MinRebuildMemory;
+
+llvm::StringRef IncrementalCompiler::copyText(llvm::StringRef Text)
+{
+    llvm::ArrayRef<char> Copy = Context->copy(llvm::ArrayRef<char>(Text.data(), Text.size()));
+    return llvm::StringRef(Copy.data(), Copy.size());
+}
+
+// Lex Region and collect its statement ends. Returns false if the last
+// statement is not complete. If Region cannot be lexed, Tokens is left empty
+// and widening it would not help, so that returns true.
+bool IncrementalCompiler::lexRegion(llvm::StringRef Region, TokenStream &Tokens,
+                                    std::vector<unsigned> &Ends)
+{
+    Lexer Lex(Region, Symbols);
+    if (!Lex.lexAll(Tokens))
+    {
+        Tokens = TokenStream();
+        return true;
+    }
+    ParallelParser::findStatementEnds(Tokens, Ends);
+    unsigned Last = Tokens.size() - 1;
+    return Last == 0 || (!Ends.empty() && Ends.back() == Last);
+}
+
+// Parse the lexed Region into units. Leftover receives the whitespace after
+// the last statement.
+bool IncrementalCompiler::parseRegion(llvm::StringRef Region, const TokenStream &Tokens,
+                                      llvm::ArrayRef<unsigned> Ends, std::vector<Unit> &NewUnits,
+                                      std::vector<Statement *> &NewStatements,
+                                      llvm::StringRef &Leftover)
+{
+    llvm::SmallVector<Statement *> Parsed;
+    Parser P(Tokens, *Context);
+    P.parseStatements(Parsed);
+    if (P.hasError())
+        return false;
+    assert(Ends.size() == Parsed.size() && "statement ends out of sync with the parser");
+
+    size_t Begin = 0;
+    for (size_t I = 0; I < Ends.size(); ++I)
+    {
+        size_t End = Tokens.getText(Ends[I] - 1).end() - Region.begin();
+        NewUnits.push_back({Region.slice(Begin, End), false});
+        NewStatements.push_back(Parsed[I]);
+        Begin = End;
+    }
+    Leftover = Region.substr(Begin);
+    return true;
+}
+
+void IncrementalCompiler::checkUnits(unsigned Begin, unsigned End, llvm::BitVector &Scope)
+{
+    Sema Semantic;
+    for (unsigned I = Begin; I < End; ++I)
+    {
+        Units[I].HasError = Semantic.semantic(llvm::ArrayRef<Statement *>(Statements[I]), Symbols, Scope);
+        if (Units[I].HasError)
+            ++ErrorUnits;
+        for (uint32_t Var : declaredVars(Statements[I]))
+            if (DeclaredAt[Var] == NotDeclared)
+                DeclaredAt[Var] = I;
+    }
+}
+
+void IncrementalCompiler::checkAll()
+{
+    std::fill(DeclaredAt.begin(), DeclaredAt.end(), NotDeclared);
+    ErrorUnits = 0;
+    llvm::BitVector Scope(Symbols.size());
+    checkUnits(0, Units.size(), Scope);
+}
+
+// The units in [Lo, Lo + NewCount) replaced OldCount units that declared the
+// same variables, so no other unit can have changed its outcome.
+void IncrementalCompiler::checkRegion(unsigned Lo, unsigned OldCount, unsigned NewCount)
+{
+    // Rebuild the scope in front of the region from the declaring units. The
+    // ones behind it shift, the ones inside are found again by checkUnits.
+    llvm::BitVector Scope(Symbols.size());
+    for (uint32_t Sym = 0; Sym < DeclaredAt.size(); ++Sym)
+    {
+        uint32_t &At = DeclaredAt[Sym];
+        if (At == NotDeclared)
+            continue;
+        if (At >= Lo + OldCount)
+            At = At - OldCount + NewCount;
+        else if (At >= Lo)
+            At = NotDeclared;
+        else
+            Scope.set(Sym);
+    }
+    checkUnits(Lo, Lo + NewCount, Scope);
+}
+
+bool IncrementalCompiler::update(llvm::StringRef Source)
+{
+    // Unchanged statements at the front...
+    unsigned N = Units.size();
+    unsigned Lo = 0;
+    size_t P = 0;
+    while (Lo < N && Source.substr(P).startswith(Units[Lo].Text))
+        P += Units[Lo++].Text.size();
+
+    // ...and at the back, behind the unchanged trailing whitespace.
+    unsigned Hi = 0;
+    size_t Q = Source.size();
+    if (Source.endswith(Tail) && Q - Tail.size() >= P)
+    {
+        size_t End = Q - Tail.size();
+        while (Lo + Hi < N)
+        {
+            llvm::StringRef Text = Units[N - 1 - Hi].Text;
+            if (End - P < Text.size() || Source.slice(End - Text.size(), End) != Text)
+                break;
+            End -= Text.size();
+            ++Hi;
+        }
+        if (Hi)
+            Q = End;
+    }
+
+    // Widen the changed range until it lexes and parses the same on its own as
+    // within the whole source: no identifier or keyword may continue across
+    // its ends, an elif or else arm needs its if, and trailing whitespace is
+    // kept as the leading whitespace of the next statement.
+    for (;;)
+    {
+        char After = P < Source.size() ? Source[P] : 0;
+        if (Lo && ((llvm::isAlnum(Source[P - 1]) && llvm::isAlnum(After)) ||
+                   startsWithArm(Source.slice(P, Q))))
+        {
+            P -= Units[--Lo].Text.size();
+            continue;
+        }
+        if (Hi && Q > P &&
+            (llvm::isSpace(Source[Q - 1]) || (llvm::isAlnum(Source[Q - 1]) && llvm::isAlnum(Source[Q]))))
+        {
+            Q += Units[N - Hi--].Text.size();
+            continue;
+        }
+        break;
+    }
+    if (!Hi)
+        Q = Source.size();
+
+    // An unchanged statement behind the range may still belong to the last
+    // statement in it, as in "x = 1;" after an inserted "int", so widen the
+    // range until it ends on a statement boundary.
+    llvm::StringRef Region;
+    TokenStream Tokens;
+    std::vector<unsigned> Ends;
+    for (;;)
+    {
+        Region = copyText(Source.slice(P, Q));
+        Tokens = TokenStream();
+        Ends.clear();
+        if (lexRegion(Region, Tokens, Ends) || !Hi)
+            break;
+        Q += Units[N - Hi--].Text.size();
+        if (!Hi)
+            Q = Source.size();
+    }
+    if (Tokens.size() == 0)
+        return false;
+
+    std::vector<Unit> NewUnits;
+    std::vector<Statement *> NewStatements;
+    llvm::StringRef Leftover;
+    if (!parseRegion(Region, Tokens, Ends, NewUnits, NewStatements, Leftover))
+        return false;
+    if (!Hi)
+        Tail = Leftover;
+
+    // Compare what the replaced and the new statements declare before
+    // splicing the new ones in.
+    unsigned OldCount = N - Lo - Hi;
+    std::vector<uint32_t> OldDecls, NewDecls;
+    for (unsigned I = Lo; I < Lo + OldCount; ++I)
+    {
+        llvm::ArrayRef<uint32_t> Vars = declaredVars(Statements[I]);
+        OldDecls.insert(OldDecls.end(), Vars.begin(), Vars.end());
+        if (Units[I].HasError)
+            --ErrorUnits;
+    }
+    for (Statement *S : NewStatements)
+    {
+        llvm::ArrayRef<uint32_t> Vars = declaredVars(S);
+        NewDecls.insert(NewDecls.end(), Vars.begin(), Vars.end());
+    }
+
+    Units.erase(Units.begin() + Lo, Units.begin() + Lo + OldCount);
+    Units.insert(Units.begin() + Lo, NewUnits.begin(), NewUnits.end());
+    Statements.erase(Statements.begin() + Lo, Statements.begin() + Lo + OldCount);
+    Statements.insert(Statements.begin() + Lo, NewStatements.begin(), NewStatements.end());
+    if (!Root)
+        Root = Context->create<Goal>(llvm::ArrayRef<Statement *>());
+    Root->setStatements(Statements);
+    LastReparsed = NewUnits.size();
+
+    DeclaredAt.resize(Symbols.size(), NotDeclared);
+    if (OldDecls == NewDecls)
+        checkRegion(Lo, OldCount, NewUnits.size());
+    else
+        checkAll();
+
+    size_t Memory = Context->getTotalMemory();
+    if (Memory >= MinRebuildMemory && Memory >= 2 * LiveMemory)
+        rebuild();
+    return ErrorUnits == 0;
+}
+
+// Move the live statements, their texts and their symbols to a fresh arena
+// and symbol table, dropping everything the replaced statements left behind.
+void IncrementalCompiler::rebuild()
+{
+    std::unique_ptr<ASTContext> NewContext = std::make_unique<ASTContext>();
+    SymbolTable NewSymbols;
+    ASTCloner Cloner(*NewContext, Symbols, NewSymbols);
+
+    std::string Source;
+    for (const Unit &U : Units)
+        Source += U.Text;
+    Source += Tail;
+    llvm::ArrayRef<char> Copy = NewContext->copy(llvm::ArrayRef<char>(Source.data(), Source.size()));
+    llvm::StringRef Text(Copy.data(), Copy.size());
+
+    size_t Begin = 0;
+    for (unsigned I = 0; I < Units.size(); ++I)
+    {
+        llvm::StringRef NewText = Text.substr(Begin, Units[I].Text.size());
+        Statements[I] = Cloner.moveStatement(Statements[I], Units[I].Text, NewText);
+        Units[I].Text = NewText;
+        Begin += NewText.size();
+    }
+    Tail = Text.substr(Begin);
+
+    // Every declared symbol occurs in a live declaration, so it has a new ID.
+    std::vector<uint32_t> NewDeclaredAt(NewSymbols.size(), NotDeclared);
+    for (uint32_t Sym = 0; Sym < DeclaredAt.size(); ++Sym)
+        if (DeclaredAt[Sym] != NotDeclared)
+            NewDeclaredAt[Cloner.getNewSymbol(Sym)] = DeclaredAt[Sym];
+    DeclaredAt = std::move(NewDeclaredAt);
+
+    Root = NewContext->create<Goal>(llvm::ArrayRef<Statement *>());
+    Root->setStatements(Statements);
+    Context = std::move(NewContext);
+    Symbols = std::move(NewSymbols);
+    LiveMemory = Context->getTotalMemory();
+}
+
+Goal *IncrementalCompiler::snapshot(ASTContext &Scratch)
+{
+    return llvm::cast<Goal>(ASTCloner(Scratch).visit(Root));
+}
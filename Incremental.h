@@ -0,0 +1,82 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "AST.h"
+#include "ASTContext.h"
+#include "Lexer.h"
+#include "SymbolTable.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/StringRef.h"
+#include <memory>
+#include <vector>
+
+// Front end for watch mode. It keeps the statement list and the declarations
+// of the last version of a program. Each update diffs the new source against
+// it by top-level statement: the unchanged leading and trailing statements
+// keep their subtrees, only the statements in between are lexed, parsed and
+// checked again. Edits that leave the declarations alone check just the
+// changed statements, others re-check the whole statement list.
+//
+// Replaced statements and their source text stay in the arena, as do the
+// identifiers they interned. Once the arena has doubled since the last
+// rebuild, the live program is moved to a fresh arena and symbol table.
+class IncrementalCompiler {
+    struct Unit {
+        llvm::StringRef Text; // Leading whitespace and the tokens of the statement
+        bool HasError;        // Semantic errors were found in it
+    };
+
+    SymbolTable Symbols;
+    std::unique_ptr<ASTContext> Context;
+    std::vector<Unit> Units;
+    std::vector<Statement *> Statements; // Parallel to Units, the Goal's child list
+    llvm::StringRef Tail;                // Whitespace after the last statement
+    std::vector<uint32_t> DeclaredAt;    // Per symbol, the unit that declares it first
+    unsigned ErrorUnits;
+    Goal *Root;
+
+    unsigned LastReparsed;
+    size_t LiveMemory; // Arena size after the last rebuild
+
+    llvm::StringRef copyText(llvm::StringRef Text);
+    bool lexRegion(llvm::StringRef Region, TokenStream &Tokens, std::vector<unsigned> &Ends);
+    bool parseRegion(llvm::StringRef Region, const TokenStream &Tokens, llvm::ArrayRef<unsigned> Ends,
+                     std::vector<Unit> &NewUnits, std::vector<Statement *> &NewStatements,
+                     llvm::StringRef &Leftover);
+    void checkUnits(unsigned Begin, unsigned End, llvm::BitVector &Scope);
+    void checkAll();
+    void checkRegion(unsigned Lo, unsigned OldCount, unsigned NewCount);
+    void rebuild();
+
+    public:
+    static const uint32_t NotDeclared = ~0u;
+
+    // The arena is not rebuilt before it holds this much.
+    static const size_t MinRebuildMemory = 1 << 20;
+
+    IncrementalCompiler()
+        : Context(std::make_unique<ASTContext>()), ErrorUnits(0), Root(nullptr), LastReparsed(0),
+          LiveMemory(0) {}
+
+    // Bring the program up to date with Source, which need not outlive the
+    // call. Returns false if the new version has errors. On a syntax error the
+    // previous version stays current.
+    bool update(llvm::StringRef Source);
+
+    Goal *getGoal() { return Root; }
+
+    // The symbols of the current program. A rebuild replaces them, so symbol
+    // IDs are only valid until the next update.
+    const SymbolTable &getSymbols() const { return Symbols; }
+
+    // A copy of the current program in Scratch. The passes rewrite the tree
+    // they run on using facts from earlier statements, which would go stale
+    // in the statements kept for the next version, so they get the copy.
+    Goal *snapshot(ASTContext &Scratch);
+
+    // Statements parsed again by the last update, and the total.
+    unsigned getReparsed() const { return LastReparsed; }
+    unsigned getStatementCount() const { return Units.size(); }
+};
+
+#endif
@@ -1,165 +1,340 @@
 #include "Lexer.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 namespace charinfo {
-    LLVM_READNONE inline bool isWhitespace(char c) {
-        return c == ' ' || c == '\t' || c == '\f' || 
-        c == '\v' ||
-        c == '\r' || c == '\n'; 
+    // Every byte is classified by a single load from a 256-entry table instead
+    // of a chain of range compares.
+    enum CharClass : uint8_t {
+        Other = 0,
+        Whitespace = 1 << 0,
+        Digit = 1 << 1,
+        Letter = 1 << 2
+    };
+
+    struct ClassTable {
+        uint8_t Class[256];
+    };
+
+    constexpr ClassTable buildClassTable() {
+        ClassTable T{};
+        T.Class[(unsigned char)' '] = Whitespace;
+        T.Class[(unsigned char)'\t'] = Whitespace;
+        T.Class[(unsigned char)'\f'] = Whitespace;
+        T.Class[(unsigned char)'\v'] = Whitespace;
+        T.Class[(unsigned char)'\r'] = Whitespace;
+        T.Class[(unsigned char)'\n'] = Whitespace;
+        for (unsigned c = '0'; c <= '9'; ++c)
+            T.Class[c] = Digit;
+        for (unsigned c = 'a'; c <= 'z'; ++c)
+            T.Class[c] = Letter;
+        for (unsigned c = 'A'; c <= 'Z'; ++c)
+            T.Class[c] = Letter;
+        return T;
     }
-    LLVM_READNONE inline bool isDigit(char c) {
-        return c >= '0' && c <= '9';
+
+    constexpr ClassTable Classes = buildClassTable();
+
+    LLVM_READNONE inline bool is(char c, CharClass CC) {
+        return Classes.Class[(unsigned char)c] & CC;
     }
-    LLVM_READNONE inline bool isLetter(char c) {
-        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
-    }   
+    LLVM_READNONE inline bool isWhitespace(char c) { return is(c, Whitespace); }
+    LLVM_READNONE inline bool isDigit(char c) { return is(c, Digit); }
+    LLVM_READNONE inline bool isLetter(char c) { return is(c, Letter); }
 }
 
-void Lexer::next(Token &token) {
-    while(*BufferPtr && charinfo::isWhitespace(*BufferPtr)) {
-        ++BufferPtr;
+namespace keywords {
+    // Perfect hash over the keyword set: (length + first + last char) & 15 is
+    // collision free for int/and/or/begin/end/if/elif/else/loopc, so a lookup
+    // is one table load plus at most one memcmp.
+    constexpr unsigned TableSize = 16;
+
+    constexpr unsigned hash(const char *Ptr, size_t Len) {
+        return (unsigned)(Len + (unsigned char)Ptr[0] + (unsigned char)Ptr[Len - 1]) & (TableSize - 1);
+    }
+
+    constexpr size_t length(const char *Str) {
+        size_t Len = 0;
+        while (Str[Len])
+            ++Len;
+        return Len;
+    }
+
+    struct Entry {
+        const char *Text;
+        size_t Len;
+        Token::TokenKind Kind;
+    };
+
+    struct Table {
+        Entry Slots[TableSize];
+    };
+
+    constexpr Entry List[] = {
+        {"int", 3, Token::KW_int},
+        {"and", 3, Token::KW_and},
+        {"or", 2, Token::KW_or},
+        {"begin", 5, Token::KW_begin},
+        {"end", 3, Token::KW_end},
+        {"if", 2, Token::KW_if},
+        {"elif", 4, Token::KW_elif},
+        {"else", 4, Token::KW_else},
+        {"loopc", 5, Token::KW_loopc},
+    };
+
+    constexpr Table buildTable() {
+        Table T{};
+        for (unsigned I = 0; I < TableSize; ++I)
+            T.Slots[I] = {"", 0, Token::ident};
+        for (const Entry &E : List)
+            T.Slots[hash(E.Text, E.Len)] = E;
+        return T;
+    }
+
+    constexpr Table Keywords = buildTable();
+
+    // Fails to compile if the keyword list is edited into a colliding set.
+    constexpr bool isPerfect() {
+        for (const Entry &E : List)
+            if (Keywords.Slots[hash(E.Text, E.Len)].Kind != E.Kind || length(E.Text) != E.Len)
+                return false;
+        return true;
+    }
+    static_assert(isPerfect(), "keyword hash has collisions");
+
+    inline Token::TokenKind lookup(const char *Ptr, size_t Len) {
+        const Entry &E = Keywords.Slots[hash(Ptr, Len)];
+        if (E.Len == Len && std::memcmp(E.Text, Ptr, Len) == 0)
+            return E.Kind;
+        return Token::ident;
+    }
+}
+
+namespace operators {
+    // Operator kinds indexed by first character: the kind of the single
+    // character token and the kind when it is immediately followed by '='.
+    struct Entry {
+        Token::TokenKind Single;
+        Token::TokenKind WithEqual;
+    };
+
+    struct Table {
+        Entry Ops[256];
+    };
+
+    constexpr Table buildTable() {
+        Table T{};
+        for (unsigned I = 0; I < 256; ++I)
+            T.Ops[I] = {Token::unknown, Token::unknown};
+        T.Ops[(unsigned char)'+'] = {Token::plus, Token::plusequal};
+        T.Ops[(unsigned char)'-'] = {Token::minus, Token::minusequal};
+        T.Ops[(unsigned char)'*'] = {Token::star, Token::starequal};
+        T.Ops[(unsigned char)'/'] = {Token::slash, Token::slashequal};
+        T.Ops[(unsigned char)'%'] = {Token::percent, Token::percentequal};
+        T.Ops[(unsigned char)'>'] = {Token::greater, Token::greaterequal};
+        T.Ops[(unsigned char)'<'] = {Token::less, Token::lessequal};
+        T.Ops[(unsigned char)'='] = {Token::equal, Token::equalequal};
+        T.Ops[(unsigned char)'!'] = {Token::unknown, Token::notequal};
+        T.Ops[(unsigned char)'^'] = {Token::power, Token::unknown};
+        T.Ops[(unsigned char)'('] = {Token::l_paren, Token::unknown};
+        T.Ops[(unsigned char)')'] = {Token::r_paren, Token::unknown};
+        T.Ops[(unsigned char)','] = {Token::comma, Token::unknown};
+        T.Ops[(unsigned char)';'] = {Token::semicolon, Token::unknown};
+        T.Ops[(unsigned char)':'] = {Token::colon, Token::unknown};
+        return T;
+    }
+
+    constexpr Table Operators = buildTable();
+}
+
+namespace scan {
+#if defined(__SSE2__)
+    // Bit I of the result is set when byte I of V belongs to class CC.
+    inline unsigned classMask(__m128i V, charinfo::CharClass CC) {
+        __m128i M;
+        if (CC == charinfo::Whitespace) {
+            // ' ' or '\t'..'\r'
+            __m128i T = _mm_sub_epi8(V, _mm_set1_epi8('\t'));
+            M = _mm_or_si128(_mm_cmpeq_epi8(V, _mm_set1_epi8(' ')),
+                             _mm_cmpeq_epi8(_mm_min_epu8(T, _mm_set1_epi8('\r' - '\t')), T));
+        } else if (CC == charinfo::Digit) {
+            __m128i T = _mm_sub_epi8(V, _mm_set1_epi8('0'));
+            M = _mm_cmpeq_epi8(_mm_min_epu8(T, _mm_set1_epi8(9)), T);
+        } else {
+            // Folding to lower case maps both letter ranges onto 'a'..'z'.
+            __m128i T = _mm_sub_epi8(_mm_or_si128(V, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+            M = _mm_cmpeq_epi8(_mm_min_epu8(T, _mm_set1_epi8(25)), T);
+        }
+        return (unsigned)_mm_movemask_epi8(M);
+    }
+#endif
+
+#if defined(__AVX2__)
+    inline unsigned classMask(__m256i V, charinfo::CharClass CC) {
+        __m256i M;
+        if (CC == charinfo::Whitespace) {
+            __m256i T = _mm256_sub_epi8(V, _mm256_set1_epi8('\t'));
+            M = _mm256_or_si256(_mm256_cmpeq_epi8(V, _mm256_set1_epi8(' ')),
+                                _mm256_cmpeq_epi8(_mm256_min_epu8(T, _mm256_set1_epi8('\r' - '\t')), T));
+        } else if (CC == charinfo::Digit) {
+            __m256i T = _mm256_sub_epi8(V, _mm256_set1_epi8('0'));
+            M = _mm256_cmpeq_epi8(_mm256_min_epu8(T, _mm256_set1_epi8(9)), T);
+        } else {
+            __m256i T = _mm256_sub_epi8(_mm256_or_si256(V, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+            M = _mm256_cmpeq_epi8(_mm256_min_epu8(T, _mm256_set1_epi8(25)), T);
+        }
+        return (unsigned)_mm256_movemask_epi8(M);
+    }
+#endif
+
+    // Returns the first position in [Ptr, End) whose character is not of class
+    // CC. Whole vectors are only loaded while they fit before End, the tail is
+    // finished with the table.
+    inline const char *skip(const char *Ptr, const char *End, charinfo::CharClass CC) {
+#if defined(__AVX2__)
+        while (End - Ptr >= 32) {
+            unsigned Miss = ~classMask(_mm256_loadu_si256((const __m256i *)Ptr), CC);
+            if (Miss)
+                return Ptr + __builtin_ctz(Miss);
+            Ptr += 32;
+        }
+#endif
+#if defined(__SSE2__)
+        while (End - Ptr >= 16) {
+            unsigned Miss = ~classMask(_mm_loadu_si128((const __m128i *)Ptr), CC) & 0xFFFF;
+            if (Miss)
+                return Ptr + __builtin_ctz(Miss);
+            Ptr += 16;
+        }
+#endif
+        while (Ptr != End && charinfo::is(*Ptr, CC))
+            ++Ptr;
+        return Ptr;
     }
-    
-    if (!BufferPtr) {
+}
+
+void Lexer::next(Token &token) {
+    BufferPtr = scan::skip(BufferPtr, BufferEnd, charinfo::Whitespace);
+
+    if (BufferPtr == BufferEnd) {
         token.Kind = Token::eoi;
+        token.Text = llvm::StringRef(BufferPtr, 0);
+        token.Value = 0;
         return;
     }
 
     if (charinfo::isLetter(*BufferPtr)) {
-        const char *end = BufferPtr + 1;
-        while (charinfo::isLetter(*end)) ++end;
-        llvm::StringRef Name(BufferPtr, end - BufferPtr);
-        if (Name == "int")
-            Token::TokenKind kind = Token::KW_int;
-        else if (Name == "and")
-            Token::TokenKind kind = Token::KW_and;
-        else if (Name == "or")
-            Token::TokenKind kind = Token::KW_or;
-        else if (Name == "begin")
-            Token::TokenKind kind = Token::KW_begin;
-        else if (Name == "end")
-            Token::TokenKind kind = Token::KW_end;
-        else if (Name == "if")
-            Token::TokenKind kind = Token::KW_if;
-        else if (Name == "elif")
-            Token::TokenKind kind = Token::KW_elif;
-        else if (Name == "else")
-            Token::TokenKind kind = Token::KW_else;
-        else if (Name == "loopc")
-            Token::TokenKind kind = Token::KW_loopc;
-        else
-            Token::TokenKind kind = Token::ident
-        formToken(token, end, kind);
+        const char *end = scan::skip(BufferPtr + 1, BufferEnd, charinfo::Letter);
+        formToken(token, end, keywords::lookup(BufferPtr, end - BufferPtr));
+        if (token.is(Token::ident))
+            token.Value = Symbols->intern(token.Text);
         return;
     }
 
-    else if (charinfo:: isDigit(*BufferPtr)) {
-        const char *end = BufferPtr + 1;
-        while (charinfo::isDigit(*end))
-            ++end;
-        formToken(token, end, Token::number);
+    if (charinfo::isDigit(*BufferPtr)) {
+        const char *end = scan::skip(BufferPtr + 1, BufferEnd, charinfo::Digit);
+        // Decode the literal once here, a value that does not fit in an int
+        // is a lexical error.
+        uint64_t Val = 0;
+        for (const char *P = BufferPtr; P != end && Val <= INT32_MAX; ++P)
+            Val = Val * 10 + (*P - '0');
+        formToken(token, end, Val <= INT32_MAX ? Token::number : Token::unknown);
+        token.Value = (uint32_t)Val;
         return;
     }
 
-    else {
-        // switch (*BufferPtr) {
-        //     #define CASE(ch, tok) \ 
-        //     case ch: formToken(token, BufferPtr + 1, tok); break
-        //     CASE('+', Token::plus)
-        //     CASE('-', Token::minus)
-        //     CASE('*', Token::star)
-        //     CASE('/', Token::slash)
-        //     CASE('(', Token::l_paren)
-        //     CASE(')', Token::r_paren)
-        //     CASE(':', Token::colon)
-        //     CASE(',', Token::comma)
-        //     CASE('=', Token::equal)
-        //     CASE(';', Token::semicolon)
-        //     CASE('^', Token::power)
-        //     CASE('%', Token::percent)
-        //     CASE('>', Token::greater)
-        //     CASE('<', Token::less)
-        //     #undef CASE
-        // }
-
-        int mode;
-        if (*BufferPtr == '+' && *(BufferPtr + 1) == '=') {
-            mode = 2;
-            Token::TokenKind kind = Token::plusequal;
-        }
-        else if (*BufferPtr == '-' && *(BufferPtr + 1) == '='){
-            mode = 2;
-            Token::TokenKind kind = Token::minusequal;
-        }
-        else if (*BufferPtr == '/' && *(BufferPtr + 1) == '='){
-            mode = 2;
-            Token::TokenKind kind = Token::slashequal;
-        }
-        else if (*BufferPtr == '%' && *(BufferPtr + 1) == '='){
-            mode = 2;
-            Token::TokenKind kind = Token::percentequal;
-        }
-        else if (*BufferPtr == '*' && *(BufferPtr + 1) == '='){
-            mode = 2;            
-            Token::TokenKind kind = Token::starequal;
-        }
-        else if (*BufferPtr == '>' && *(BufferPtr + 1) == '='){
-            mode = 2;            
-            Token::TokenKind kind = Token::greaterequal;
-        }
-        else if (*BufferPtr == '<' && *(BufferPtr + 1) == '='){
-            mode = 2;            
-            Token::TokenKind kind = Token::lessequal;
-        }
-        else if (*BufferPtr == '=' && *(BufferPtr + 1) == '='){
-            mode = 2;            
-            Token::TokenKind kind = Token::equalequal;
-        }
-        else if (*BufferPtr == '!' && *(BufferPtr + 1) == '='){
-            mode = 2;            
-            Token::TokenKind kind = Token::notqeual;
-        }
-        else if (*BufferPtr == '+'){
-            mode = 1;            
-            Token::TokenKind kind = Token::plus;
-        }
-        else if (*BufferPtr == '-'){
-            mode = 1;            
-            Token::TokenKind kind = Token::minus;
-        }
-        else if (*BufferPtr == '/'){
-            mode = 1;            
-            Token::TokenKind kind = Token::slash;
-        }
-        else if (*BufferPtr == '%'){
-            mode = 1;
-            Token::TokenKind kind = Token::percent;
-        }
-        else if (*BufferPtr == '*'){
-            mode = 1;
-            Token::TokenKind kind = Token::star;
-        }
-        else if (*BufferPtr == '>'){
-            mode = 1;
-            Token::TokenKind kind = Token::greater;
-        }
-        else if (*BufferPtr == '<'){
-            mode = 1;
-            Token::TokenKind kind = Token::less;
-        }
-        else if (*BufferPtr == '='){
-            mode = 1;
-            Token::TokenKind kind = Token::equal;
-        }
-        else{
-            Token::TokenKind kind = Token::unknown;
-        }
-        formToken(token, BufferPtr + mode, Token::kind)
+    const operators::Entry &Op = operators::Operators.Ops[(unsigned char)*BufferPtr];
+    if (Op.WithEqual != Token::unknown && BufferPtr + 1 != BufferEnd && *(BufferPtr + 1) == '=') {
+        formToken(token, BufferPtr + 2, Op.WithEqual);
         return;
     }
+    formToken(token, BufferPtr + 1, Op.Single);
 }
 
 void Lexer::formToken(Token &Tok, const char *TokEnd, Token::TokenKind Kind) {
     Tok.Kind = Kind;
-    Tok.Text = llvm::StringRef(BufferPtr, TokEnd, BufferPtr);
-    BufferPtr = TokEnd
-}
\ No newline at end of file
+    Tok.Value = 0;
+    Tok.Text = llvm::StringRef(BufferPtr, TokEnd - BufferPtr);
+    BufferPtr = TokEnd;
+}
+
+bool Lexer::lexAll(TokenStream &Tokens) {
+    if (BufferEnd - BufferStart > UINT32_MAX) {
+        llvm::errs() << "Input too large for a token stream\n";
+        return false;
+    }
+
+    Tokens.Buffer = llvm::StringRef(BufferStart, BufferEnd - BufferStart);
+    Tokens.Kinds.clear();
+    Tokens.Offsets.clear();
+    Tokens.Lengths.clear();
+    Tokens.Values.clear();
+
+    // Roughly one token per four bytes of typical source.
+    size_t Estimate = (BufferEnd - BufferPtr) / 4 + 1;
+    Tokens.Kinds.reserve(Estimate);
+    Tokens.Offsets.reserve(Estimate);
+    Tokens.Lengths.reserve(Estimate);
+    Tokens.Values.reserve(Estimate);
+
+    Token Tok;
+    do {
+        next(Tok);
+        Token::TokenKind Kind = Tok.getKind();
+        size_t Len = Tok.getText().size();
+        // Written as one string, the chunks of a parallel parse are lexed
+        // on several threads.
+        if (Len > UINT16_MAX) {
+            llvm::errs() << ("Token longer than 65535 bytes: " + Tok.getText().take_front(16) + "...\n").str();
+            return false;
+        }
+        Tokens.Kinds.push_back(Kind);
+        Tokens.Offsets.push_back(Tok.getText().begin() - BufferStart);
+        Tokens.Lengths.push_back(Len);
+        Tokens.Values.push_back(Tok.Value);
+    } while (!Tok.is(Token::eoi));
+    return true;
+}
+
+void TokenStream::assign(llvm::StringRef Whole, llvm::ArrayRef<TokenStream> Chunks,
+                         llvm::ArrayRef<std::vector<uint32_t>> SymbolMaps) {
+    Buffer = Whole;
+    Kinds.clear();
+    Offsets.clear();
+    Lengths.clear();
+    Values.clear();
+
+    size_t Total = 1;
+    for (const TokenStream &Chunk : Chunks)
+        Total += Chunk.size() - 1;
+    Kinds.reserve(Total);
+    Offsets.reserve(Total);
+    Lengths.reserve(Total);
+    Values.reserve(Total);
+
+    // Every chunk ends with its own eoi token, only the last one is kept.
+    for (size_t C = 0; C < Chunks.size(); ++C) {
+        const TokenStream &Chunk = Chunks[C];
+        const std::vector<uint32_t> &Map = SymbolMaps[C];
+        uint32_t Base = Chunk.Buffer.begin() - Whole.begin();
+        unsigned Count = Chunk.size() - 1;
+        Kinds.insert(Kinds.end(), Chunk.Kinds.begin(), Chunk.Kinds.begin() + Count);
+        Lengths.insert(Lengths.end(), Chunk.Lengths.begin(), Chunk.Lengths.begin() + Count);
+        for (unsigned I = 0; I < Count; ++I) {
+            Offsets.push_back(Base + Chunk.Offsets[I]);
+            uint32_t Value = Chunk.Values[I];
+            Values.push_back(Chunk.Kinds[I] == Token::ident ? Map[Value] : Value);
+        }
+    }
+    Kinds.push_back(Token::eoi);
+    Offsets.push_back(Whole.size());
+    Lengths.push_back(0);
+    Values.push_back(0);
+}
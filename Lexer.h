@@ -1,13 +1,18 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/StringRef.h"
-#include "llvm/Support/MemoryBuffer.h"
+#include "SymbolTable.h"
+#include <cstdint>
+#include <vector>
 
 class Lexer;
+class TokenStream;
 
 class Token {
-    friend class Lexer
+    friend class Lexer;
+    friend class TokenStream;
 
     public:
         enum TokenKind: unsigned short
@@ -50,32 +55,84 @@ class Token {
             KW_loopc
         };
     private:
-    TokenKind;
+    TokenKind Kind;
     llvm::StringRef Text; // points to the start of the text of the token
+    uint32_t Value;       // symbol ID of an ident, decoded value of a number
 
     public:
     TokenKind getKind() const { return Kind; }
     llvm::StringRef getText() const { return Text; }
+    uint32_t getSymbol() const { return Value; }
+    int getNumber() const { return (int)Value; }
 
     //to test if the token is of a certain kind
-    bool is(TokenKind K) const { return Kind == K}
+    bool is(TokenKind K) const { return Kind == K; }
     bool isOneOf(TokenKind K1, TokenKind K2) const { return is(K1) || is(K2); }
         template <typename... Ts>
         bool isOneOf(TokenKind K1, TokenKind K2, Ts... Ks) const { return is(K1) || isOneOf(K2, Ks...); }
 };
 
+// The whole buffer lexed up front into parallel arrays, 11 bytes per token:
+// a 1-byte kind, a 4-byte offset, a 2-byte length and the 4-byte symbol ID
+// or literal value. The stream always ends with an eoi token, so any index
+// past the end reads as eoi. Token texts are recovered from the buffer,
+// which must outlive the stream.
+class TokenStream {
+    friend class Lexer;
+
+    llvm::StringRef Buffer;
+    std::vector<uint8_t> Kinds;
+    std::vector<uint32_t> Offsets;
+    std::vector<uint16_t> Lengths;
+    std::vector<uint32_t> Values;
+
+    public:
+    unsigned size() const { return Kinds.size(); }
+    llvm::StringRef getBuffer() const { return Buffer; }
+
+    Token::TokenKind getKind(unsigned I) const {
+        return I < Kinds.size() ? (Token::TokenKind)Kinds[I] : Token::eoi;
+    }
+    llvm::StringRef getText(unsigned I) const {
+        if (I >= Kinds.size())
+            I = Kinds.size() - 1;
+        return Buffer.substr(Offsets[I], Lengths[I]);
+    }
+    uint32_t getValue(unsigned I) const { return I < Values.size() ? Values[I] : 0; }
+    void get(unsigned I, Token &Tok) const {
+        Tok.Kind = getKind(I);
+        Tok.Text = getText(I);
+        Tok.Value = getValue(I);
+    }
+
+    // Replace the contents with the concatenation of Chunks, each lexed from
+    // a consecutive piece of Whole, rebasing their offsets onto Whole. Each
+    // chunk was lexed with its own symbol table, SymbolMaps[I] maps the IDs of
+    // chunk I to the IDs of the shared table.
+    void assign(llvm::StringRef Whole, llvm::ArrayRef<TokenStream> Chunks,
+                llvm::ArrayRef<std::vector<uint32_t>> SymbolMaps);
+};
+
 class Lexer {
     const char *BufferStart;
+    const char *BufferEnd; // one past the last character, input need not be NUL-terminated
     const char *BufferPtr;
+    SymbolTable *Symbols; // identifiers are interned here as they are lexed
 
     public:
-    Lexer(const llvm::StringRef &Buffer) {
+    Lexer(const llvm::StringRef &Buffer, SymbolTable &Symbols) : Symbols(&Symbols) {
         BufferStart = Buffer.begin();
+        BufferEnd = Buffer.end();
         BufferPtr = BufferStart;
     }
     
     void next(Token &token);
 
+    // Lex everything from the current position into Tokens. Reports an error
+    // and fails if the buffer is too large for 32-bit offsets or a token is
+    // too long for a 16-bit length.
+    bool lexAll(TokenStream &Tokens);
+
     private:
     void formToken(Token &Result, const char *TokEnd, Token::TokenKind Kind);
 };
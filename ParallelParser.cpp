@@ -0,0 +1,174 @@
+#include "ParallelParser.h"
+#include "parser.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include <algorithm>
+
+namespace {
+// Work is split into a few pieces per thread so one slow piece does not
+// leave the other threads idle.
+const unsigned PiecesPerThread = 4;
+
+// Smallest chunk worth handing to another thread.
+const size_t MinChunkBytes = 64 * 1024;
+
+bool isSplitChar(char C)
+{
+    // No token contains whitespace or continues past a ';', so the buffer can
+    // be cut in front of either without changing how it lexes.
+    return C == ' ' || C == '\t' || C == '\f' || C == '\v' || C == '\r' ||
+           C == '\n' || C == ';';
+}
+}
+
+bool ParallelParser::lex()
+{
+    if (Buffer.size() > UINT32_MAX)
+    {
+        llvm::errs() << "Input too large for a token stream\n";
+        return false;
+    }
+
+    // Pick cut points near evenly spaced offsets.
+    size_t Pieces = std::max<size_t>(1, std::min<size_t>(Threads * PiecesPerThread,
+                                                         Buffer.size() / MinChunkBytes));
+    std::vector<llvm::StringRef> Chunks;
+    size_t Start = 0;
+    for (size_t I = 1; I < Pieces && Start < Buffer.size(); ++I)
+    {
+        size_t Cut = std::max(Start, Buffer.size() * I / Pieces);
+        while (Cut < Buffer.size() && !isSplitChar(Buffer[Cut]))
+            ++Cut;
+        if (Cut == Buffer.size())
+            break;
+        Chunks.push_back(Buffer.slice(Start, Cut));
+        Start = Cut;
+    }
+    Chunks.push_back(Buffer.slice(Start, Buffer.size()));
+
+    // Each chunk interns into its own table, the tables are merged into the
+    // shared one afterwards in source order so IDs stay deterministic.
+    std::vector<TokenStream> Streams(Chunks.size());
+    std::vector<SymbolTable> ChunkSymbols(Chunks.size());
+    std::vector<char> Lexed(Chunks.size());
+    {
+        llvm::ThreadPool Pool(llvm::hardware_concurrency(Threads));
+        for (size_t I = 0; I < Chunks.size(); ++I)
+            Pool.async([&Chunks, &Streams, &ChunkSymbols, &Lexed, I] {
+                Lexer Lex(Chunks[I], ChunkSymbols[I]);
+                Lexed[I] = Lex.lexAll(Streams[I]);
+            });
+        Pool.wait();
+    }
+    if (std::find(Lexed.begin(), Lexed.end(), 0) != Lexed.end())
+        return false;
+
+    std::vector<std::vector<uint32_t>> SymbolMaps(Chunks.size());
+    for (size_t I = 0; I < Chunks.size(); ++I)
+    {
+        SymbolMaps[I].resize(ChunkSymbols[I].size());
+        for (uint32_t ID = 0; ID < ChunkSymbols[I].size(); ++ID)
+            SymbolMaps[I][ID] = Symbols.intern(ChunkSymbols[I].getName(ID));
+    }
+
+    Tokens.assign(Buffer, Streams, SymbolMaps);
+    return true;
+}
+
+// Collect the index one past the last token of every top-level statement.
+// A statement ends at a ';' outside any begin/end block, or at the 'end' that
+// closes its outermost block unless an 'elif' or 'else' arm follows.
+void ParallelParser::findStatementEnds(const TokenStream &Tokens, std::vector<unsigned> &Ends)
+{
+    int Depth = 0;
+    unsigned Size = Tokens.size();
+    for (unsigned I = 0; I < Size; ++I)
+    {
+        switch (Tokens.getKind(I))
+        {
+            case Token::KW_begin:
+                ++Depth;
+                break;
+            case Token::KW_end:
+                if (--Depth == 0 &&
+                    !(Tokens.getKind(I + 1) == Token::KW_elif || Tokens.getKind(I + 1) == Token::KW_else))
+                    Ends.push_back(I + 1);
+                break;
+            case Token::semicolon:
+                if (Depth == 0)
+                    Ends.push_back(I + 1);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+AST *ParallelParser::parse()
+{
+    if (!lex())
+    {
+        HasError = true;
+        return nullptr;
+    }
+
+    std::vector<unsigned> Ends;
+    findStatementEnds(Tokens, Ends);
+
+    // Group consecutive statements into pieces of roughly equal token count.
+    // The last piece runs to the end of the stream so trailing tokens that do
+    // not form a complete statement are still reported by its parser.
+    unsigned Last = Tokens.size() - 1;
+    unsigned Target = std::max<unsigned>(1, Last / (Threads * PiecesPerThread));
+    std::vector<std::pair<unsigned, unsigned>> Ranges;
+    unsigned Begin = 0;
+    for (unsigned End : Ends)
+    {
+        if (End - Begin >= Target && End < Last)
+        {
+            Ranges.push_back({Begin, End});
+            Begin = End;
+        }
+    }
+    Ranges.push_back({Begin, Last});
+
+    // Bump allocation is not thread-safe, every piece gets its own child
+    // context which lives as long as the main one.
+    std::vector<ASTContext *> Contexts(Ranges.size());
+    for (size_t I = 0; I < Ranges.size(); ++I)
+        Contexts[I] = &Context.createChild();
+
+    // Each piece collects its diagnostics, only the first piece with an error
+    // reports them. A statement the ranges split wrongly, such as an if
+    // missing its begin, owns the first error, and the pieces after it would
+    // only report follow-on errors the serial parser never gets to.
+    std::vector<llvm::SmallVector<Statement *>> Results(Ranges.size());
+    std::vector<std::string> Diagnostics(Ranges.size());
+    std::vector<char> Errors(Ranges.size(), false);
+    {
+        llvm::ThreadPool Pool(llvm::hardware_concurrency(Threads));
+        for (size_t I = 0; I < Ranges.size(); ++I)
+            Pool.async([this, &Ranges, &Contexts, &Results, &Diagnostics, &Errors, I] {
+                llvm::raw_string_ostream OS(Diagnostics[I]);
+                Parser P(Tokens, Ranges[I].first, Ranges[I].second, *Contexts[I]);
+                P.setDiagnostics(OS);
+                P.setHashCons(HashCons);
+                P.parseStatements(Results[I]);
+                Errors[I] = P.hasError();
+            });
+        Pool.wait();
+    }
+
+    llvm::SmallVector<Statement *> Statements;
+    for (size_t I = 0; I < Results.size(); ++I)
+    {
+        if (Errors[I])
+        {
+            llvm::errs() << Diagnostics[I];
+            HasError = true;
+            return nullptr;
+        }
+        Statements.append(Results[I].begin(), Results[I].end());
+    }
+    return Context.create<Goal>(Context.copy(Statements));
+}
@@ -0,0 +1,44 @@
+#ifndef PARALLELPARSER_H
+#define PARALLELPARSER_H
+
+#include "AST.h"
+#include "ASTContext.h"
+#include "Lexer.h"
+#include <vector>
+
+// Front end for very large programs. The buffer is cut into chunks at
+// whitespace, the chunks are lexed concurrently and joined into one token
+// stream, which is then split at top-level statement boundaries and parsed
+// piecewise on a thread pool. The statement lists are stitched back into a
+// single Goal in source order.
+class ParallelParser {
+    llvm::StringRef Buffer;
+    unsigned Threads;
+    SymbolTable &Symbols;
+    ASTContext &Context;
+    TokenStream Tokens;
+    bool HasError;
+    bool HashCons;
+
+    bool lex();
+
+    public:
+    ParallelParser(llvm::StringRef Buffer, unsigned Threads, SymbolTable &Symbols, ASTContext &Context)
+        : Buffer(Buffer), Threads(Threads), Symbols(Symbols), Context(Context), HasError(false),
+          HashCons(false) {}
+
+    bool hasError() { return HasError; }
+
+    // Hash-cons expressions within each piece, see Parser::setHashCons.
+    void setHashCons(bool Enable) { HashCons = Enable; }
+
+    // The token stream of the whole buffer, valid after parse().
+    const TokenStream &getTokens() const { return Tokens; }
+
+    AST *parse();
+
+    // Collect the index one past the last token of every top-level statement.
+    static void findStatementEnds(const TokenStream &Tokens, std::vector<unsigned> &Ends);
+};
+
+#endif
@@ -0,0 +1,653 @@
+#include "RangeAnalysis.h"
+#include "StaticVisitor.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+// An interval of int32 values, held in 64 bits so the bounds of a result can
+// be computed before checking that it fits. Empty when Lo > Hi.
+struct Range {
+  int64_t Lo, Hi;
+
+  Range() : Lo(INT32_MIN), Hi(INT32_MAX) {}
+  Range(int64_t Lo, int64_t Hi) : Lo(Lo), Hi(Hi) {}
+
+  static Range empty() { return Range(1, 0); }
+
+  // The range of a result, or the full range if it may not fit in 32 bits:
+  // the operation can then overflow and nothing is known about it.
+  static Range fit(int64_t Lo, int64_t Hi) {
+    if (Lo < INT32_MIN || Hi > INT32_MAX)
+      return Range();
+    return Range(Lo, Hi);
+  }
+
+  bool isEmpty() const { return Lo > Hi; }
+  bool isConstant() const { return Lo == Hi; }
+  bool isNonNegative() const { return Lo >= 0; }
+
+  bool operator==(const Range &R) const { return Lo == R.Lo && Hi == R.Hi; }
+  bool operator!=(const Range &R) const { return !(*this == R); }
+
+  Range join(const Range &R) const {
+    if (isEmpty())
+      return R;
+    if (R.isEmpty())
+      return *this;
+    return Range(std::min(Lo, R.Lo), std::max(Hi, R.Hi));
+  }
+
+  Range meet(const Range &R) const {
+    Range M(std::max(Lo, R.Lo), std::min(Hi, R.Hi));
+    return M.isEmpty() ? empty() : M;
+  }
+};
+
+Range add(Range L, Range R) { return Range::fit(L.Lo + R.Lo, L.Hi + R.Hi); }
+
+Range sub(Range L, Range R) { return Range::fit(L.Lo - R.Hi, L.Hi - R.Lo); }
+
+Range mul(Range L, Range R) {
+  int64_t P[] = {L.Lo * R.Lo, L.Lo * R.Hi, L.Hi * R.Lo, L.Hi * R.Hi};
+  return Range::fit(*std::min_element(P, P + 4), *std::max_element(P, P + 4));
+}
+
+// Dividing by zero is undefined, so only the non-zero divisors count. For
+// divisors of one sign the quotient is monotonic in both operands and its
+// extremes are at the corners.
+Range div(Range L, Range R) {
+  if (L.isConstant() && R.isConstant() && R.Lo != 0)
+    return Range::fit(L.Lo / R.Lo, L.Lo / R.Lo);
+  Range Q = Range::empty();
+  auto Corners = [&](int64_t D1, int64_t D2) {
+    for (int64_t N : {L.Lo, L.Hi})
+      for (int64_t D : {D1, D2})
+        Q = Q.join(Range(N / D, N / D));
+  };
+  if (R.Lo <= -1)
+    Corners(R.Lo, std::min<int64_t>(R.Hi, -1));
+  if (R.Hi >= 1)
+    Corners(std::max<int64_t>(R.Lo, 1), R.Hi);
+  if (Q.isEmpty())
+    return Range();
+  return Range::fit(Q.Lo, Q.Hi);
+}
+
+// The remainder takes the sign of the dividend, is smaller in magnitude than
+// the divisor and no larger in magnitude than the dividend.
+Range rem(Range L, Range R) {
+  if (L.isConstant() && R.isConstant() && R.Lo != 0)
+    return Range(L.Lo % R.Lo, L.Lo % R.Lo);
+  int64_t M = std::max(std::llabs(R.Lo), std::llabs(R.Hi));
+  if (M == 0)
+    return Range();
+  Range Res(-(M - 1), M - 1);
+  return Res.meet(Range(std::min<int64_t>(L.Lo, 0), std::max<int64_t>(L.Hi, 0)));
+}
+
+// x ^ N is 1 for N = 0 and 1 / x ^ -N rounded toward zero for N < 0, which
+// is 0 unless x is 1 or -1, and 0 for x = 0 too. For |x| >= 2 a positive
+// exponent above 30 overflows, so the multiplications below end quickly.
+// The power wraps on overflow like the other operations, so a result that
+// may overflow has the full range whatever the sign of x.
+Range pow(Range L, Range R) {
+  bool Unit = L.Lo >= -1 && L.Hi <= 1;
+  if (!R.isConstant()) {
+    if (Unit)
+      return Range(-1, 1);
+    // No power is larger in magnitude than the largest |x| raised to the
+    // largest exponent, if that fits. Exponents of 0 and below give 1, 0 or
+    // -1, which the bound covers too.
+    int64_t M = std::max(std::llabs(L.Lo), std::llabs(L.Hi));
+    int64_t Max = 1;
+    for (int64_t I = 0; I < R.Hi; ++I)
+      if ((Max *= M) > INT32_MAX)
+        return Range();
+    return L.isNonNegative() ? Range(0, Max) : Range(-Max, Max);
+  }
+  int64_t N = R.Lo;
+  if (N == 0)
+    return Range(1, 1);
+  if (N < 0) {
+    if (L.isConstant()) {
+      int64_t V = L.Lo == 1 ? 1 : L.Lo == -1 ? (N % 2 ? -1 : 1) : 0;
+      return Range(V, V);
+    }
+    return N % 2 == 0 || L.isNonNegative() ? Range(0, 1) : Range(-1, 1);
+  }
+  if (Unit) {
+    if (N % 2)
+      return L;
+    return Range(L.Lo <= 0 && L.Hi >= 0 ? 0 : 1, L.Lo == 0 && L.Hi == 0 ? 0 : 1);
+  }
+  Range V = L;
+  for (int64_t I = 1; I < N && V != Range(); ++I)
+    V = mul(V, L);
+  return V;
+}
+
+// Collects the variables an if or loopc statement reads or assigns, the only
+// ones whose range it can narrow or change.
+class VarCollector : public RecursiveVisitor<VarCollector> {
+  llvm::SmallVectorImpl<uint32_t> &Vars;
+
+public:
+  VarCollector(llvm::SmallVectorImpl<uint32_t> &Vars) : Vars(Vars) {}
+
+  void visitFinal(Final &Node) {
+    if (Node.getKind() == Final::Id)
+      Vars.push_back(Node.getSymbol());
+  }
+};
+
+class RangeVisitor : public StaticVisitor<RangeVisitor, Range> {
+  typedef llvm::SmallVector<uint32_t, 8> VarList;
+  typedef llvm::SmallVector<Range, 8> RangeList;
+
+  enum Truth { False, True, Unknown };
+
+  ASTContext &Context;
+  std::vector<Range> Vars; // Current range of every variable, by symbol ID
+  bool Annotate;           // Record ranges and flags in the nodes visited, fold constants
+  unsigned Removed;
+  llvm::DenseSet<Expr *> Annotated; // Shared nodes annotated at an earlier occurrence
+
+  // Iterations of a loop before the bounds that still move are widened.
+  static const unsigned WideningDelay = 3;
+  // Iterations from the widened state that may tighten it again.
+  static const unsigned NarrowingSteps = 2;
+
+  void save(const VarList &Touched, RangeList &Saved) {
+    Saved.clear();
+    for (uint32_t Var : Touched)
+      Saved.push_back(Vars[Var]);
+  }
+
+  void restore(const VarList &Touched, const RangeList &Saved) {
+    for (size_t I = 0; I < Touched.size(); ++I)
+      Vars[Touched[I]] = Saved[I];
+  }
+
+  // Range of an operation and the flags it earns from the operand ranges.
+  Range arith(BinaryOp::Operator Op, Range L, Range R, uint8_t &Flags) {
+    Flags = 0;
+    bool NonNegative = L.isNonNegative() && R.isNonNegative();
+    Range Res;
+    switch (Op) {
+    case BinaryOp::plus:
+      Res = add(L, R);
+      if (NonNegative && Res != Range())
+        Flags |= AF_NoUnsignedWrap;
+      break;
+    case BinaryOp::minus:
+      Res = sub(L, R);
+      if (NonNegative && L.Lo >= R.Hi)
+        Flags |= AF_NoUnsignedWrap;
+      break;
+    case BinaryOp::star:
+      Res = mul(L, R);
+      if (NonNegative && Res != Range())
+        Flags |= AF_NoUnsignedWrap;
+      break;
+    case BinaryOp::slash:
+      Res = div(L, R);
+      if (NonNegative)
+        Flags |= AF_NonNegative;
+      if (L == Range(0, 0) || R == Range(1, 1) || R == Range(-1, -1))
+        Flags |= AF_Exact;
+      break;
+    case BinaryOp::percent:
+      Res = rem(L, R);
+      if (NonNegative)
+        Flags |= AF_NonNegative;
+      break;
+    case BinaryOp::pow:
+      Res = pow(L, R);
+      break;
+    }
+    return Res;
+  }
+
+  static bool compare(Condition::OperatorCondition Op, Range L, Range R, Truth &T) {
+    switch (Op) {
+    case Condition::greater:
+      T = L.Lo > R.Hi ? True : L.Hi <= R.Lo ? False : Unknown;
+      break;
+    case Condition::less:
+      T = L.Hi < R.Lo ? True : L.Lo >= R.Hi ? False : Unknown;
+      break;
+    case Condition::greaterequal:
+      T = L.Lo >= R.Hi ? True : L.Hi < R.Lo ? False : Unknown;
+      break;
+    case Condition::lessequal:
+      T = L.Hi <= R.Lo ? True : L.Lo > R.Hi ? False : Unknown;
+      break;
+    case Condition::equalequal:
+    case Condition::notequal:
+      if (L.isConstant() && L == R)
+        T = True;
+      else if (L.meet(R).isEmpty())
+        T = False;
+      else
+        T = Unknown;
+      if (Op == Condition::notequal && T != Unknown)
+        T = T == True ? False : True;
+      break;
+    default:
+      llvm_unreachable("unknown comparison");
+    }
+    return T != Unknown;
+  }
+
+  static Condition::OperatorCondition negate(Condition::OperatorCondition Op) {
+    switch (Op) {
+    case Condition::greater:
+      return Condition::lessequal;
+    case Condition::less:
+      return Condition::greaterequal;
+    case Condition::greaterequal:
+      return Condition::less;
+    case Condition::lessequal:
+      return Condition::greater;
+    case Condition::equalequal:
+      return Condition::notequal;
+    case Condition::notequal:
+      return Condition::equalequal;
+    }
+    llvm_unreachable("unknown comparison");
+  }
+
+  // The comparison with its operands swapped.
+  static Condition::OperatorCondition swap(Condition::OperatorCondition Op) {
+    switch (Op) {
+    case Condition::greater:
+      return Condition::less;
+    case Condition::less:
+      return Condition::greater;
+    case Condition::greaterequal:
+      return Condition::lessequal;
+    case Condition::lessequal:
+      return Condition::greaterequal;
+    default:
+      return Op;
+    }
+  }
+
+  // Narrow the variable in E, if E is one, to the values X with X Op R.
+  bool narrow(Expr *E, Condition::OperatorCondition Op, Range R) {
+    Final *F = llvm::dyn_cast<Final>(E);
+    if (!F || F->getKind() != Final::Id)
+      return true;
+    Range &X = Vars[F->getSymbol()];
+    switch (Op) {
+    case Condition::greater:
+      X = X.meet(Range(R.Lo + 1, INT32_MAX));
+      break;
+    case Condition::less:
+      X = X.meet(Range(INT32_MIN, R.Hi - 1));
+      break;
+    case Condition::greaterequal:
+      X = X.meet(Range(R.Lo, INT32_MAX));
+      break;
+    case Condition::lessequal:
+      X = X.meet(Range(INT32_MIN, R.Hi));
+      break;
+    case Condition::equalequal:
+      X = X.meet(R);
+      break;
+    case Condition::notequal:
+      // Only a constant at either end of the range can be cut off.
+      if (R.isConstant() && X.Lo == R.Lo)
+        X = X.meet(Range(R.Lo + 1, INT32_MAX));
+      else if (R.isConstant() && X.Hi == R.Lo)
+        X = X.meet(Range(INT32_MIN, R.Lo - 1));
+      break;
+    }
+    return !X.isEmpty();
+  }
+
+  // Narrow the variables to the states in which Cond evaluates to Taken.
+  // Returns false if there are none. Disjunctions are not split, so this
+  // only narrows through "and" when taken and "or" when not.
+  bool refine(C *Cond, bool Taken) {
+    if (Condition *Cmp = llvm::dyn_cast<Condition>(Cond)) {
+      bool OldAnnotate = Annotate;
+      Annotate = false;
+      Range L = visit(Cmp->getLeft());
+      Range R = visit(Cmp->getRight());
+      Annotate = OldAnnotate;
+      Condition::OperatorCondition Op = Taken ? Cmp->getOpC() : negate(Cmp->getOpC());
+      Truth T = Unknown;
+      if (compare(Op, L, R, T) && T == False)
+        return false;
+      return narrow(Cmp->getLeft(), Op, R) && narrow(Cmp->getRight(), swap(Op), L);
+    }
+    if ((Cond->getLOp() == C::KW_and) == Taken)
+      return refine(Cond->getLeft(), Taken) && refine(Cond->getRight(), Taken);
+    return true;
+  }
+
+  // Evaluate Cond as far as the ranges tell, annotating and folding its
+  // operands. A side of an "and" that is always true, or of an "or" that is
+  // always false, is dropped from Cond.
+  Truth eval(C *&Cond) {
+    if (Condition *Cmp = llvm::dyn_cast<Condition>(Cond)) {
+      Range L = visit(Cmp->getLeft());
+      Range R = visit(Cmp->getRight());
+      if (Annotate) {
+        Cmp->setLeft(fold(Cmp->getLeft(), L));
+        Cmp->setRight(fold(Cmp->getRight(), R));
+      }
+      Truth T = Unknown;
+      compare(Cmp->getOpC(), L, R, T);
+      return T;
+    }
+    C *Left = Cond->getLeft();
+    C *Right = Cond->getRight();
+    Truth L = eval(Left);
+    Truth R = eval(Right);
+    Truth Dominant = Cond->getLOp() == C::KW_and ? False : True;
+    if (Annotate) {
+      Cond->setLeft(Left);
+      Cond->setRight(Right);
+      if (L != Unknown && L != Dominant)
+        Cond = Right;
+      else if (R != Unknown && R != Dominant)
+        Cond = Left;
+    }
+    if (L == Dominant || R == Dominant)
+      return Dominant;
+    return L == Unknown || R == Unknown ? Unknown : L;
+  }
+
+  bool annotatedBefore(Expr &Node) { return Node.isShared() && !Annotated.insert(&Node).second; }
+
+  Final *literal(int64_t Value) {
+    std::string Text = std::to_string(Value);
+    llvm::ArrayRef<char> Copy = Context.copy(llvm::ArrayRef<char>(Text.data(), Text.size()));
+    return Context.create<Final>(Final::Num, llvm::StringRef(Copy.data(), Copy.size()), (uint32_t)Value);
+  }
+
+  // E, or a literal if it has a single possible value.
+  Expr *fold(Expr *E, Range R) {
+    if (!R.isConstant())
+      return E;
+    Final *F = llvm::dyn_cast<Final>(E);
+    if (F && F->getKind() == Final::Num)
+      return E;
+    return literal(R.Lo);
+  }
+
+  // Like eval, and also proves conditions the narrowing finds no state for.
+  Truth decide(C *&Cond, const VarList &Touched, const RangeList &State) {
+    restore(Touched, State);
+    Truth T = eval(Cond);
+    if (T != Unknown)
+      return T;
+    if (!refine(Cond, false))
+      T = True;
+    restore(Touched, State);
+    if (T == Unknown && !refine(Cond, true))
+      T = False;
+    restore(Touched, State);
+    return T;
+  }
+
+  void equations(llvm::ArrayRef<Equation *> Equations) {
+    for (Equation *Eq : Equations)
+      equation(*Eq);
+  }
+
+  void equation(Equation &Node) {
+    Final *Id = Node.getId();
+    Range Val = visit(Node.getE());
+    if (Node.getOp() != Equation::equal) {
+      static const BinaryOp::Operator Ops[] = {BinaryOp::plus, BinaryOp::plus, BinaryOp::minus,
+                                               BinaryOp::star, BinaryOp::slash, BinaryOp::percent};
+      Range Old = Vars[Id->getSymbol()];
+      uint8_t Flags;
+      if (Annotate)
+        Node.setE(fold(Node.getE(), Val));
+      Val = arith(Ops[Node.getOp()], Old, Val, Flags);
+      if (Annotate) {
+        Node.setFlags(Flags);
+        // An update with a known result becomes a plain assignment.
+        if (Val.isConstant()) {
+          Node.setOp(Equation::equal);
+          Node.setE(literal(Val.Lo));
+          Node.setFlags(0);
+        }
+      }
+    } else if (Annotate) {
+      Node.setE(fold(Node.getE(), Val));
+    }
+    Vars[Id->getSymbol()] = Val;
+  }
+
+  void declaration(Declaration &Node) {
+    llvm::ArrayRef<uint32_t> DeclVars = Node.getVars();
+    llvm::ArrayRef<Expr *> Exprs = Node.getExprs();
+    llvm::SmallVector<Expr *, 4> Folded(Exprs.begin(), Exprs.end());
+    bool Changed = false;
+    for (size_t I = 0; I < DeclVars.size(); ++I) {
+      Range Val;
+      if (I < Exprs.size()) {
+        Val = visit(Exprs[I]);
+        Folded[I] = fold(Exprs[I], Val);
+        Changed |= Folded[I] != Exprs[I];
+      }
+      Vars[DeclVars[I]] = Val;
+    }
+    if (Changed)
+      Node.setExprs(Context.copy(Folded));
+  }
+
+  // Append what is left of Node to Out: the arms that can be taken, with an
+  // arm that is always taken when reached becoming the else arm. Returns
+  // false if nothing was removed.
+  bool ifStatement(If &Node, llvm::SmallVectorImpl<Statement *> &Out) {
+    struct Arm {
+      C *Cond;
+      llvm::ArrayRef<Equation *> Equations;
+      Elif *Node;
+    };
+    llvm::SmallVector<Arm, 4> Arms, Kept;
+    Arms.push_back({Node.getConditions(), Node.getEquations(), nullptr});
+    for (Elif *E : Node.getElifs())
+      Arms.push_back({E->getConditions(), E->getEquations(), E});
+
+    VarList Touched;
+    VarCollector(Touched).visit(&Node);
+
+    // Rest is the state in which no arm so far was taken, Joined the union
+    // of the states after the taken ones.
+    RangeList Rest, Joined(Touched.size(), Range::empty());
+    save(Touched, Rest);
+    auto Join = [&]() {
+      for (size_t I = 0; I < Touched.size(); ++I)
+        Joined[I] = Joined[I].join(Vars[Touched[I]]);
+    };
+
+    Else *ElseArm = Node.getElsestate();
+    bool RestReachable = true;
+    for (Arm &A : Arms) {
+      Truth T = decide(A.Cond, Touched, Rest);
+      if (A.Node)
+        A.Node->setConditions(A.Cond);
+      else
+        Node.setConditions(A.Cond);
+      if (T == False)
+        continue;
+      if (T == True) {
+        equations(A.Equations);
+        Join();
+        ElseArm = Context.create<Else>(A.Equations);
+        RestReachable = false;
+        break;
+      }
+      refine(A.Cond, true);
+      equations(A.Equations);
+      Join();
+      Kept.push_back(A);
+      restore(Touched, Rest);
+      refine(A.Cond, false);
+      save(Touched, Rest);
+    }
+    if (RestReachable) {
+      restore(Touched, Rest);
+      if (ElseArm)
+        equations(ElseArm->getEquations());
+      Join();
+    }
+    restore(Touched, Joined);
+
+    if (Kept.size() == Arms.size()) {
+      Out.push_back(&Node);
+      return false;
+    }
+    ++Removed;
+    if (Kept.empty()) {
+      if (ElseArm)
+        Out.append(ElseArm->getEquations().begin(), ElseArm->getEquations().end());
+      return true;
+    }
+    llvm::SmallVector<Elif *, 4> Elifs;
+    for (size_t I = 1; I < Kept.size(); ++I)
+      Elifs.push_back(Kept[I].Node ? Kept[I].Node : Context.create<Elif>(Kept[I].Cond, Kept[I].Equations));
+    Out.push_back(Context.create<If>(Kept[0].Cond, Kept[0].Equations, Context.copy(Elifs), ElseArm));
+    return true;
+  }
+
+  // Iterate the body to a fixpoint at the loop head, widening the bounds
+  // that keep moving, then narrow the result again by running the body from
+  // it. A last walk from there annotates the body. Returns false if the loop
+  // never runs.
+  bool loop(Loop &Node) {
+    VarList Touched;
+    VarCollector(Touched).visit(&Node);
+    RangeList Entry, Head, Next;
+    save(Touched, Entry);
+
+    // The states before the fixpoint is reached are not those of the loop,
+    // nothing is recorded from them.
+    bool OldAnnotate = Annotate;
+    Annotate = false;
+    C *Cond = Node.getConditions();
+    if (decide(Cond, Touched, Entry) == False) {
+      Annotate = OldAnnotate;
+      ++Removed;
+      return false;
+    }
+
+    // Next becomes From joined with the state after one iteration from Head.
+    auto Step = [&](const RangeList &From) {
+      restore(Touched, Head);
+      Next = From;
+      if (refine(Node.getConditions(), true)) {
+        equations(Node.getEquations());
+        for (size_t I = 0; I < Touched.size(); ++I)
+          Next[I] = Next[I].join(Vars[Touched[I]]);
+      }
+    };
+
+    Head = Entry;
+    for (unsigned Iteration = 0;; ++Iteration) {
+      Step(Head);
+      if (Next == Head)
+        break;
+      if (Iteration >= WideningDelay) {
+        for (size_t I = 0; I < Touched.size(); ++I) {
+          if (Next[I].Lo < Head[I].Lo)
+            Next[I].Lo = INT32_MIN;
+          if (Next[I].Hi > Head[I].Hi)
+            Next[I].Hi = INT32_MAX;
+        }
+      }
+      Head = Next;
+    }
+    for (unsigned Iteration = 0; Iteration < NarrowingSteps; ++Iteration) {
+      Step(Entry);
+      if (Next == Head)
+        break;
+      Head = Next;
+    }
+    Annotate = OldAnnotate;
+
+    restore(Touched, Head);
+    eval(Cond);
+    Node.setConditions(Cond);
+    refine(Node.getConditions(), true);
+    equations(Node.getEquations());
+
+    // A loop whose condition always holds never exits, what follows is
+    // unreachable and any state will do.
+    restore(Touched, Head);
+    if (!refine(Node.getConditions(), false))
+      restore(Touched, Head);
+    return true;
+  }
+
+public:
+  RangeVisitor(const SymbolTable &Symbols, ASTContext &Context)
+      : Context(Context), Vars(Symbols.size()), Annotate(true), Removed(0) {}
+
+  unsigned getRemoved() { return Removed; }
+
+  Range visitGoal(Goal &Node) {
+    llvm::SmallVector<Statement *, 16> Kept;
+    bool Changed = false;
+    for (Statement *S : Node.getStatements()) {
+      if (Declaration *D = llvm::dyn_cast<Declaration>(S)) {
+        declaration(*D);
+        Kept.push_back(S);
+      } else if (Equation *Eq = llvm::dyn_cast<Equation>(S)) {
+        equation(*Eq);
+        Kept.push_back(S);
+      } else if (If *I = llvm::dyn_cast<If>(S)) {
+        Changed |= ifStatement(*I, Kept);
+      } else if (loop(*llvm::cast<Loop>(S))) {
+        Kept.push_back(S);
+      } else {
+        Changed = true;
+      }
+    }
+    if (Changed)
+      Node.setStatements(Context.copy(Kept));
+    return Range();
+  }
+
+  Range visitFinal(Final &Node) {
+    if (Node.getKind() == Final::Num)
+      return Range(Node.getNumber(), Node.getNumber());
+    return Vars[Node.getSymbol()];
+  }
+
+  // A shared node records the flags that hold at all of its occurrences,
+  // and its operands are not folded.
+  Range visitBinaryOp(BinaryOp &Node) {
+    Range L = visit(Node.getLeft());
+    Range R = visit(Node.getRight());
+    if (Annotate && !Node.isShared()) {
+      Node.setLeft(fold(Node.getLeft(), L));
+      Node.setRight(fold(Node.getRight(), R));
+    }
+    uint8_t Flags;
+    Range Res = arith(Node.getOperator(), L, R, Flags);
+    if (Annotate)
+      Node.setFlags(annotatedBefore(Node) ? Flags & Node.getFlags() : Flags);
+    return Res;
+  }
+};
+}
+
+unsigned RangeAnalysis::analyze(AST *Tree, const SymbolTable &Symbols, ASTContext &Context) {
+  if (!Tree)
+    return 0;
+  RangeVisitor Ranges(Symbols, Context);
+  Ranges.visit(Tree);
+  return Ranges.getRemoved();
+}
@@ -0,0 +1,21 @@
+#ifndef RANGEANALYSIS_H
+#define RANGEANALYSIS_H
+
+#include "AST.h"
+#include "ASTContext.h"
+#include "SymbolTable.h"
+
+// Interval analysis of the values of every variable through declarations,
+// assignments, if/elif/else and loopc. It records the ArithFlags of each
+// operation it proves in the AST for CodeGen. Expressions with a single
+// possible value are folded into literals, so constants propagate through
+// the program, and the arms and loops whose conditions it proves false are
+// removed. Runs on a checked tree.
+class RangeAnalysis
+{
+public:
+  // Returns the number of arms and loops removed.
+  unsigned analyze(AST *Tree, const SymbolTable &Symbols, ASTContext &Context);
+};
+
+#endif
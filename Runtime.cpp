@@ -0,0 +1,39 @@
+#include "Runtime.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static std::vector<int> Recorded;
+static size_t NextRecorded;
+static bool Replaying = false;
+
+void runtime::write(int V)
+{
+  if (!Replaying)
+    std::printf("The result is: %d\n", V);
+}
+
+int runtime::read(const char *Name)
+{
+  if (Replaying)
+    return NextRecorded < Recorded.size() ? Recorded[NextRecorded++] : 0;
+
+  char Buf[64];
+  int Val;
+  std::printf("Enter a value for %s: ", Name);
+  if (!std::fgets(Buf, sizeof(Buf), stdin))
+    Buf[0] = '\0';
+  if (EOF == std::sscanf(Buf, "%d", &Val))
+  {
+    std::printf("Value %s is invalid\n", Buf);
+    std::exit(1);
+  }
+  Recorded.push_back(Val);
+  return Val;
+}
+
+void runtime::replay()
+{
+  Replaying = true;
+  NextRecorded = 0;
+}
@@ -0,0 +1,22 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+// The input and output of a program executed inside the compiler, with the
+// same behavior as main_write and main_read of rtmain.c. Programs run
+// in-process call these in place of the ones linked from rtmain.c.
+namespace runtime
+{
+  void write(int V);
+
+  // Prompts for the variable Name and reads its value from stdin, exits the
+  // process on invalid input.
+  int read(const char *Name);
+
+  // Benchmarks execute a program many times. The values read so far are
+  // recorded, after replay() every read returns them again in order without
+  // prompting and writes print nothing. Each call starts from the first
+  // value.
+  void replay();
+} // namespace runtime
+
+#endif
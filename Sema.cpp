@@ -1,10 +1,12 @@
 #include "Sema.h"
-#include "llvm/ADT/StringSet.h"
+#include "StaticVisitor.h"
+#include "llvm/ADT/BitVector.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace {
-class InputCheck : public ASTVisitor {
-  llvm::StringSet<> Scope; // StringSet to store declared variables
+class InputCheck : public RecursiveVisitor<InputCheck> {
+  const SymbolTable &Symbols;
+  llvm::BitVector &Scope; // Bit per symbol ID, set once the variable is declared
   bool HasError; // Flag to indicate if an error occurred
 
   enum ErrorType { Twice, Not }; // Enum to represent error types: Twice - variable declared twice, Not - variable not declared
@@ -18,73 +20,100 @@ class InputCheck : public ASTVisitor {
   }
 
 public:
-  InputCheck() : HasError(false) {} // Constructor
+  InputCheck(const SymbolTable &Symbols, llvm::BitVector &Scope)
+      : Symbols(Symbols), Scope(Scope), HasError(false) {} // Constructor
 
   bool hasError() { return HasError; } // Function to check if an error occurred
 
-  // Visit function for main nodes
-  virtual void visit(Goal &Node) override { 
-    for (auto I = Node.begin(), E = Node.end(); I != E; ++I)
-    {
-      (*I)->accept(*this); // Visit each child node
-    }
-  };
-
-  // Visit function for Factor nodes
-  virtual void visit(Final &Node) override {
-    if (Node.getKind() == Final::Id) {
-      // Check if identifier is in the scope
-      if (Scope.find(Node.getVal()) == Scope.end())
-        error(Not, Node.getVal());
-    }
-  };
-
-  // Visit function for BinaryOp nodes
-  virtual void visit(BinaryOp &Node) override {
-    if (Node.getLeft())
-      Node.getLeft()->accept(*this);
-    else
-      HasError = true;
-
-    auto right = Node.getRight();
-    if (right)
-      right->accept(*this);
-    else
-      HasError = true;
+  // Identifiers, both uses and assignment targets, must be in scope
+  void visitFinal(Final &Node) {
+    if (Node.getKind() == Final::Id && !Scope.test(Node.getSymbol()))
+      error(Not, Node.getVal());
+  }
 
-    if (Node.getOperator() == Expression::BinaryOp::slash && right) {
-      Factor * f = (Factor *)right;
-      
-      if (right && f->getKind() == Final::ValueKind::Num) {
-        int intval;
-        f->getVal().getAsInteger(10, intval);
+  void visitBinaryOp(BinaryOp &Node) {
+    RecursiveVisitor::visitBinaryOp(Node);
 
-        if (intval == 0) {
-          llvm::errs() << "Division by zero is not allowed." << "\n";
-          HasError = true;
-        }
+    if (Node.getOperator() == BinaryOp::slash) {
+      Final *F = llvm::dyn_cast<Final>(Node.getRight());
+      if (F && F->getKind() == Final::Num && F->getNumber() == 0) {
+        llvm::errs() << "Division by zero is not allowed." << "\n";
+        HasError = true;
       }
     }
-  };
+  }
 
-  virtual void visit(Declaration &Node) override {
-    for (auto I = Node.begin(), E = Node.end(); I != E;
-         ++I) {
-      if (!Scope.insert(*I).second)
-        error(Twice, *I); // If the insertion fails (element already exists in Scope), report a "Twice" error
+  // Each variable comes into scope after its own initializer is checked
+  void visitDeclaration(Declaration &Node) {
+    llvm::ArrayRef<uint32_t> Vars = Node.getVars();
+    llvm::ArrayRef<Expr *> Exprs = Node.getExprs();
+    for (size_t I = 0; I < Vars.size(); ++I) {
+      if (I < Exprs.size())
+        visit(Exprs[I]);
+      if (Scope.test(Vars[I]))
+        error(Twice, Symbols.getName(Vars[I])); // If the variable is already in Scope, report a "Twice" error
+      Scope.set(Vars[I]);
     }
-    if (Node.getExpr())
-      Node.getExpr()->accept(*this); // If the Declaration node has an expression, recursively visit the expression node
-  };
+  }
 };
 }
 
-bool Sema::semantic(AST *Tree) {
+bool Sema::semantic(AST *Tree, const SymbolTable &Symbols) {
   if (!Tree)
     return false; // If the input AST is not valid, return false indicating no errors
 
-  InputCheck Check; // Create an instance of the InputCheck class for semantic analysis
-  Tree->accept(Check); // Initiate the semantic analysis by traversing the AST using the accept function
+  llvm::BitVector Scope(Symbols.size());
+  InputCheck Check(Symbols, Scope); // Create an instance of the InputCheck class for semantic analysis
+  Check.visit(Tree); // Initiate the semantic analysis by traversing the AST
 
   return Check.hasError(); // Return the result of Check.hasError() indicating if any errors were detected during the analysis
-}
\ No newline at end of file
+}
+
+bool Sema::semantic(llvm::ArrayRef<Statement *> Statements, const SymbolTable &Symbols,
+                    llvm::BitVector &Scope) {
+  InputCheck Check(Symbols, Scope);
+  for (Statement *S : Statements)
+    Check.visit(S);
+  return Check.hasError();
+}
+
+bool Sema::semantic(const FlatAST &Tree, const SymbolTable &Symbols) {
+  // In post-order every use comes before the statement that contains it and
+  // statements come in source order, so one forward sweep over the node
+  // arrays performs the same checks as InputCheck.
+  llvm::BitVector Scope(Symbols.size());
+  bool HasError = false;
+  for (uint32_t N = 0, E = Tree.size(); N != E; ++N) {
+    switch (Tree.getKind(N)) {
+    case FlatAST::Id:
+    case FlatAST::Assign:
+    case FlatAST::AddAssign:
+    case FlatAST::SubAssign:
+    case FlatAST::MulAssign:
+    case FlatAST::DivAssign:
+    case FlatAST::RemAssign:
+      if (!Scope.test(Tree.getData(N))) {
+        llvm::errs() << "Variable " << Symbols.getName(Tree.getData(N)) << " is not declared\n";
+        HasError = true;
+      }
+      break;
+    case FlatAST::Declare:
+      if (Scope.test(Tree.getData(N))) {
+        llvm::errs() << "Variable " << Symbols.getName(Tree.getData(N)) << " is already declared\n";
+        HasError = true;
+      }
+      Scope.set(Tree.getData(N));
+      break;
+    case FlatAST::Div:
+      // The right operand is the node just before its parent.
+      if (Tree.getKind(N - 1) == FlatAST::Num && Tree.getData(N - 1) == 0) {
+        llvm::errs() << "Division by zero is not allowed." << "\n";
+        HasError = true;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  return HasError;
+}
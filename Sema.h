@@ -2,11 +2,20 @@
 #define SEMA_H
 
 #include "AST.h"
+#include "FlatAST.h"
 #include "Lexer.h"
+#include "SymbolTable.h"
+#include "llvm/ADT/BitVector.h"
 
 class Sema {
 public:
-  bool semantic(AST *Tree);
+  bool semantic(AST *Tree, const SymbolTable &Symbols);
+  bool semantic(const FlatAST &Tree, const SymbolTable &Symbols);
+
+  // Check a run of top-level statements. Scope holds the variables declared
+  // before the first one and receives the ones they declare.
+  bool semantic(llvm::ArrayRef<Statement *> Statements, const SymbolTable &Symbols,
+                llvm::BitVector &Scope);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,135 @@
+#ifndef STATICVISITOR_H
+#define STATICVISITOR_H
+
+#include "AST.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/ErrorHandling.h"
+
+// StaticVisitor is a CRTP visitor. visit() switches on the node kind tag and
+// calls the derived class's visitX method directly, so there is no virtual
+// call per node, the calls can be inlined, and each visit returns a typed
+// result. A derived class declares the visitX methods it handles, hiding the
+// defaults here, which forward to the method of the parent node class and
+// end in visitAST.
+template <typename Derived, typename RetTy = void>
+class StaticVisitor
+{
+  Derived &derived() { return *static_cast<Derived *>(this); }
+
+public:
+  RetTy visit(AST *Node)
+  {
+    switch (Node->getNodeKind())
+    {
+    case AST::NK_Goal:
+      return derived().visitGoal(*llvm::cast<Goal>(Node));
+    case AST::NK_Final:
+      return derived().visitFinal(*llvm::cast<Final>(Node));
+    case AST::NK_BinaryOp:
+      return derived().visitBinaryOp(*llvm::cast<BinaryOp>(Node));
+    case AST::NK_Declaration:
+      return derived().visitDeclaration(*llvm::cast<Declaration>(Node));
+    case AST::NK_Equation:
+      return derived().visitEquation(*llvm::cast<Equation>(Node));
+    case AST::NK_If:
+      return derived().visitIf(*llvm::cast<If>(Node));
+    case AST::NK_Loop:
+      return derived().visitLoop(*llvm::cast<Loop>(Node));
+    case AST::NK_Elif:
+      return derived().visitElif(*llvm::cast<Elif>(Node));
+    case AST::NK_Else:
+      return derived().visitElse(*llvm::cast<Else>(Node));
+    case AST::NK_C:
+      return derived().visitC(*llvm::cast<C>(Node));
+    case AST::NK_Condition:
+      return derived().visitCondition(*llvm::cast<Condition>(Node));
+    }
+    llvm_unreachable("unknown AST node kind");
+  }
+
+  RetTy visitGoal(Goal &Node) { return derived().visitExpr(Node); }
+  RetTy visitFinal(Final &Node) { return derived().visitExpr(Node); }
+  RetTy visitBinaryOp(BinaryOp &Node) { return derived().visitExpr(Node); }
+  RetTy visitDeclaration(Declaration &Node) { return derived().visitStatement(Node); }
+  RetTy visitEquation(Equation &Node) { return derived().visitStatement(Node); }
+  RetTy visitIf(If &Node) { return derived().visitStatement(Node); }
+  RetTy visitLoop(Loop &Node) { return derived().visitStatement(Node); }
+  RetTy visitElif(Elif &Node) { return derived().visitAST(Node); }
+  RetTy visitElse(Else &Node) { return derived().visitAST(Node); }
+  RetTy visitCondition(Condition &Node) { return derived().visitC(Node); }
+  RetTy visitC(C &Node) { return derived().visitAST(Node); }
+  RetTy visitExpr(Expr &Node) { return derived().visitAST(Node); }
+  RetTy visitStatement(Statement &Node) { return derived().visitAST(Node); }
+  RetTy visitAST(AST &) { return RetTy(); }
+};
+
+// RecursiveVisitor walks the whole tree in source order. A derived class
+// declares the visitX methods it is interested in and calls the base
+// version from them to keep walking into the children. Children are visited
+// through the derived class's visit(), so it can also hook every node.
+template <typename Derived>
+class RecursiveVisitor : public StaticVisitor<Derived>
+{
+  Derived &derived() { return *static_cast<Derived *>(this); }
+
+  void visitEquations(llvm::ArrayRef<Equation *> Equations)
+  {
+    for (Equation *Eq : Equations)
+      derived().visit(Eq);
+  }
+
+public:
+  void visitGoal(Goal &Node)
+  {
+    for (Statement *S : Node.getStatements())
+      derived().visit(S);
+  }
+  void visitFinal(Final &) {}
+  void visitBinaryOp(BinaryOp &Node)
+  {
+    derived().visit(Node.getLeft());
+    derived().visit(Node.getRight());
+  }
+  void visitDeclaration(Declaration &Node)
+  {
+    for (Expr *E : Node.getExprs())
+      derived().visit(E);
+  }
+  void visitEquation(Equation &Node)
+  {
+    derived().visit(Node.getId());
+    derived().visit(Node.getE());
+  }
+  void visitIf(If &Node)
+  {
+    derived().visit(Node.getConditions());
+    visitEquations(Node.getEquations());
+    for (Elif *E : Node.getElifs())
+      derived().visit(E);
+    if (Node.getElsestate())
+      derived().visit(Node.getElsestate());
+  }
+  void visitElif(Elif &Node)
+  {
+    derived().visit(Node.getConditions());
+    visitEquations(Node.getEquations());
+  }
+  void visitElse(Else &Node) { visitEquations(Node.getEquations()); }
+  void visitLoop(Loop &Node)
+  {
+    derived().visit(Node.getConditions());
+    visitEquations(Node.getEquations());
+  }
+  void visitC(C &Node)
+  {
+    derived().visit(Node.getLeft());
+    derived().visit(Node.getRight());
+  }
+  void visitCondition(Condition &Node)
+  {
+    derived().visit(Node.getLeft());
+    derived().visit(Node.getRight());
+  }
+};
+
+#endif
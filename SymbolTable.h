@@ -0,0 +1,35 @@
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <vector>
+
+// Interns identifiers into dense IDs 0..size()-1 so later phases can index
+// flat vectors and bit vectors by variable instead of hashing names.
+class SymbolTable {
+    llvm::StringMap<uint32_t> IDs;
+    std::vector<llvm::StringRef> Names;
+
+public:
+    uint32_t intern(llvm::StringRef Name) {
+        auto Res = IDs.try_emplace(Name, (uint32_t)Names.size());
+        if (Res.second)
+            Names.push_back(Res.first->getKey());
+        return Res.first->second;
+    }
+
+    // ID of an already interned name, NotFound otherwise.
+    static const uint32_t NotFound = ~0u;
+    uint32_t lookup(llvm::StringRef Name) const {
+        auto It = IDs.find(Name);
+        return It == IDs.end() ? NotFound : It->second;
+    }
+
+    llvm::StringRef getName(uint32_t ID) const { return Names[ID]; }
+
+    unsigned size() const { return Names.size(); }
+};
+
+#endif
@@ -0,0 +1,28 @@
+#include "Tiered.h"
+
+TieredEngine::TieredEngine(CodeGen &CodeGenerator, AST *Tree, const SymbolTable &Symbols,
+                           unsigned Threshold)
+    : CodeGenerator(CodeGenerator), Symbols(Symbols),
+      Prog(bytecode::compile(Tree, Symbols, /*CountLoops=*/true)), Threshold(Threshold),
+      Counts(Prog.Loops.size()), Failed(Prog.Loops.size())
+{
+}
+
+// The variables come first in the registers, they are what the compiled
+// loop reads and updates. The count starts over after the loop is run, the
+// code is specialized to this entry. A loop that fails to compile is left
+// to the interpreter.
+bool TieredEngine::enter(uint32_t Loop, int32_t *Registers)
+{
+  if (Failed[Loop] || ++Counts[Loop] < Threshold)
+    return false;
+  Counts[Loop] = 0;
+  CodeGen::LoopFn Fn = CodeGenerator.compileLoop(Prog.Loops[Loop], Symbols, Registers);
+  if (!Fn)
+  {
+    Failed[Loop] = true;
+    return false;
+  }
+  Fn(Registers);
+  return true;
+}
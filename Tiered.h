@@ -0,0 +1,31 @@
+#ifndef TIERED_H
+#define TIERED_H
+
+#include "Bytecode.h"
+#include "CodeGen.h"
+#include "SymbolTable.h"
+#include <vector>
+
+// Starts a program on the bytecode interpreter and counts the iterations of
+// each loop. A loop that reaches Threshold is compiled with the JIT, its
+// variables specialized to their values at that iteration boundary, and the
+// native code runs the rest of it before interpreting resumes after it.
+class TieredEngine : public bytecode::LoopHook
+{
+  CodeGen &CodeGenerator;
+  const SymbolTable &Symbols;
+  bytecode::Program Prog;
+  unsigned Threshold;
+  std::vector<unsigned> Counts; // Iterations interpreted, indexed by loop
+  std::vector<bool> Failed;     // Loops the JIT could not compile
+
+public:
+  TieredEngine(CodeGen &CodeGenerator, AST *Tree, const SymbolTable &Symbols, unsigned Threshold);
+
+  bool enter(uint32_t Loop, int32_t *Registers) override;
+
+  // Returns what the generated main would return.
+  int execute() { return bytecode::execute(Prog, this); }
+};
+
+#endif
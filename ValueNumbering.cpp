@@ -0,0 +1,249 @@
+#include "ValueNumbering.h"
+#include "StaticVisitor.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/ScopedHashTable.h"
+#include "llvm/ADT/SmallVector.h"
+#include <utility>
+#include <vector>
+
+namespace {
+// Numbers every expression, returning its value number. The table holds the
+// first node of each value that is evaluated on every path to the current
+// point: a scope is opened for each part of an if or loopc that not every
+// later path passes through. A shared node is evaluated once per
+// occurrence, it is neither linked nor linked to.
+class Numberer : public StaticVisitor<Numberer, uint32_t> {
+  // Operator, then the value numbers of the operands. Comparisons are
+  // numbered past the arithmetic operators.
+  typedef std::pair<uint64_t, uint32_t> Key;
+  struct Entry {
+    uint32_t Number;
+    AST *First; // Null for values only held by a variable
+  };
+  typedef llvm::ScopedHashTable<Key, Entry> TableTy;
+  typedef llvm::ScopedHashTableScope<Key, Entry> ScopeTy;
+
+  static const unsigned ConditionBase = 16;
+
+  TableTy Table;
+  // Value number of each number, keyed wider than the numbers since
+  // DenseMap reserves the largest keys.
+  llvm::DenseMap<uint64_t, uint32_t> Literals;
+  std::vector<uint32_t> Vars; // Value number of each variable, by symbol ID
+  uint32_t Next;              // 0 means no value number
+  unsigned Linked;
+
+  uint32_t fresh() { return Next++; }
+
+  static Key makeKey(unsigned Op, uint32_t L, uint32_t R) { return Key(((uint64_t)Op << 32) | L, R); }
+
+  // The value number of Op applied to L and R, and the first node computing
+  // it if there is one.
+  Entry find(unsigned Op, uint32_t L, uint32_t R) { return Table.lookup(makeKey(Op, L, R)); }
+
+  typedef llvm::SmallVector<uint32_t, 8> VarList;
+
+  static void collectAssigned(llvm::ArrayRef<Equation *> Equations, VarList &Assigned) {
+    for (Equation *Eq : Equations)
+      Assigned.push_back(Eq->getId()->getSymbol());
+  }
+
+  void save(const VarList &Assigned, VarList &Saved) {
+    Saved.clear();
+    for (uint32_t Var : Assigned)
+      Saved.push_back(Vars[Var]);
+  }
+
+  void restore(const VarList &Assigned, const VarList &Saved) {
+    for (size_t I = 0; I < Assigned.size(); ++I)
+      Vars[Assigned[I]] = Saved[I];
+  }
+
+  // Give the assigned variables new value numbers.
+  void clobber(const VarList &Assigned) {
+    for (uint32_t Var : Assigned)
+      Vars[Var] = fresh();
+  }
+
+  void equations(llvm::ArrayRef<Equation *> Equations) {
+    for (Equation *Eq : Equations)
+      visit(Eq);
+  }
+
+public:
+  Numberer(const SymbolTable &Symbols) : Vars(Symbols.size(), 0), Next(1), Linked(0) {}
+
+  unsigned getLinked() { return Linked; }
+
+  uint32_t visitGoal(Goal &Node) {
+    ScopeTy Scope(Table);
+    for (Statement *S : Node.getStatements())
+      visit(S);
+    return 0;
+  }
+
+  uint32_t visitFinal(Final &Node) {
+    if (Node.getKind() == Final::Id)
+      return Vars[Node.getSymbol()];
+    uint32_t &Number = Literals[(uint32_t)Node.getNumber()];
+    if (!Number)
+      Number = fresh();
+    return Number;
+  }
+
+  uint32_t visitBinaryOp(BinaryOp &Node) {
+    uint32_t L = visit(Node.getLeft());
+    uint32_t R = visit(Node.getRight());
+    BinaryOp::Operator Op = Node.getOperator();
+    if ((Op == BinaryOp::plus || Op == BinaryOp::star) && L > R)
+      std::swap(L, R);
+    Entry E = find(Op, L, R);
+    if (E.First && !Node.isShared()) {
+      Node.setSame(llvm::cast<BinaryOp>(E.First));
+      ++Linked;
+      return E.Number;
+    }
+    uint32_t Number = E.Number ? E.Number : fresh();
+    if (!Node.isShared())
+      Table.insert(makeKey(Op, L, R), {Number, &Node});
+    else if (!E.Number)
+      Table.insert(makeKey(Op, L, R), {Number, nullptr});
+    return Number;
+  }
+
+  // Swapping the operands of a comparison swaps its direction, so a > b
+  // and b < a get the same number.
+  uint32_t visitCondition(Condition &Node) {
+    uint32_t L = visit(Node.getLeft());
+    uint32_t R = visit(Node.getRight());
+    Condition::OperatorCondition Op = Node.getOpC();
+    if (L > R) {
+      std::swap(L, R);
+      switch (Op) {
+      case Condition::greater:
+        Op = Condition::less;
+        break;
+      case Condition::less:
+        Op = Condition::greater;
+        break;
+      case Condition::greaterequal:
+        Op = Condition::lessequal;
+        break;
+      case Condition::lessequal:
+        Op = Condition::greaterequal;
+        break;
+      default:
+        break;
+      }
+    }
+    Entry E = find(ConditionBase + Op, L, R);
+    if (E.First) {
+      Node.setSame(llvm::cast<Condition>(E.First));
+      ++Linked;
+      return E.Number;
+    }
+    uint32_t Number = fresh();
+    Table.insert(makeKey(ConditionBase + Op, L, R), {Number, &Node});
+    return Number;
+  }
+
+  uint32_t visitC(C &Node) {
+    visit(Node.getLeft());
+    visit(Node.getRight());
+    return 0;
+  }
+
+  // A variable takes the number of its initializer, or a new one when it is
+  // read from the input.
+  uint32_t visitDeclaration(Declaration &Node) {
+    llvm::ArrayRef<uint32_t> DeclVars = Node.getVars();
+    llvm::ArrayRef<Expr *> Exprs = Node.getExprs();
+    for (size_t I = 0; I < DeclVars.size(); ++I)
+      Vars[DeclVars[I]] = I < Exprs.size() ? visit(Exprs[I]) : fresh();
+    return 0;
+  }
+
+  // A compound assignment computes its operation without a node of its
+  // own, it can only take the number of an earlier one.
+  uint32_t visitEquation(Equation &Node) {
+    static const BinaryOp::Operator Ops[] = {BinaryOp::plus, BinaryOp::plus, BinaryOp::minus,
+                                             BinaryOp::star, BinaryOp::slash, BinaryOp::percent};
+    uint32_t Value = visit(Node.getE());
+    uint32_t &Var = Vars[Node.getId()->getSymbol()];
+    if (Node.getOp() != Equation::equal) {
+      BinaryOp::Operator Op = Ops[Node.getOp()];
+      uint32_t L = Var, R = Value;
+      if ((Op == BinaryOp::plus || Op == BinaryOp::star) && L > R)
+        std::swap(L, R);
+      Entry E = find(Op, L, R);
+      Value = E.Number;
+      if (!Value) {
+        Value = fresh();
+        Table.insert(makeKey(Op, L, R), {Value, nullptr});
+      }
+    }
+    Var = Value;
+    return 0;
+  }
+
+  // The first condition is evaluated on every path, each later one on the
+  // paths into the arms after it, an arm's equations only within it.
+  // Variables assigned in any arm get new numbers after the if.
+  uint32_t visitIf(If &Node) {
+    VarList Assigned, Before;
+    collectAssigned(Node.getEquations(), Assigned);
+    for (Elif *E : Node.getElifs())
+      collectAssigned(E->getEquations(), Assigned);
+    if (Else *E = Node.getElsestate())
+      collectAssigned(E->getEquations(), Assigned);
+    save(Assigned, Before);
+
+    visit(Node.getConditions());
+    {
+      ScopeTy Conditions(Table);
+      {
+        ScopeTy Arm(Table);
+        equations(Node.getEquations());
+      }
+      for (Elif *E : Node.getElifs()) {
+        restore(Assigned, Before);
+        visit(E->getConditions());
+        ScopeTy Arm(Table);
+        equations(E->getEquations());
+      }
+      if (Else *E = Node.getElsestate()) {
+        restore(Assigned, Before);
+        ScopeTy Arm(Table);
+        equations(E->getEquations());
+      }
+    }
+    clobber(Assigned);
+    return 0;
+  }
+
+  // The variables the body assigns get new numbers for the loop head, which
+  // they keep after the loop. The condition is evaluated at the head, on
+  // every path through and past the loop.
+  uint32_t visitLoop(Loop &Node) {
+    VarList Assigned, Head;
+    collectAssigned(Node.getEquations(), Assigned);
+    clobber(Assigned);
+    save(Assigned, Head);
+    visit(Node.getConditions());
+    {
+      ScopeTy Body(Table);
+      equations(Node.getEquations());
+    }
+    restore(Assigned, Head);
+    return 0;
+  }
+};
+}
+
+unsigned ValueNumbering::number(AST *Tree, const SymbolTable &Symbols) {
+  if (!Tree)
+    return 0;
+  Numberer Numbers(Symbols);
+  Numbers.visit(Tree);
+  return Numbers.getLinked();
+}
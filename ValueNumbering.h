@@ -0,0 +1,21 @@
+#ifndef VALUENUMBERING_H
+#define VALUENUMBERING_H
+
+#include "AST.h"
+#include "SymbolTable.h"
+
+// Value numbering over the expressions of a checked tree. A BinaryOp or
+// Condition whose operator and operand value numbers match an earlier one
+// evaluated on every path to it is linked to that one with setSame, and
+// CodeGen reuses its result instead of evaluating it again. An assignment
+// gives its variable a new number, so nothing computed from the old value
+// matches afterwards. Run it last before CodeGen, passes that remove
+// statements would leave links to nodes that are never evaluated.
+class ValueNumbering
+{
+public:
+  // Returns the number of evaluations linked to an earlier one.
+  unsigned number(AST *Tree, const SymbolTable &Symbols);
+};
+
+#endif
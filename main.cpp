@@ -1,9 +1,26 @@
+#include "ASTCache.h"
+#include "ASTContext.h"
+#include "Bytecode.h"
 #include "CodeGen.h"
-#include "Parser.h"
+#include "CompileCache.h"
+#include "Incremental.h"
+#include "ParallelParser.h"
+#include "parser.h"
+#include "RangeAnalysis.h"
+#include "Runtime.h"
+#include "optimizer.h"
 #include "Sema.h"
+#include "ValueNumbering.h"
+#include "StaticVisitor.h"
+#include "Tiered.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
+#include <chrono>
+#include <thread>
 
 // Define a command-line option for specifying the input expression.
 static llvm::cl::opt<std::string>
@@ -11,6 +28,515 @@ static llvm::cl::opt<std::string>
           llvm::cl::desc("<input expression>"),
           llvm::cl::init(""));
 
+// Define a command-line option for reading the program from a file instead.
+static llvm::cl::opt<std::string>
+    InputFile("file",
+              llvm::cl::desc("Read the program from <filename> ('-' for stdin)"),
+              llvm::cl::value_desc("filename"),
+              llvm::cl::init(""));
+
+// Define a command-line option for lexing the whole input before parsing.
+static llvm::cl::opt<bool>
+    PreLex("pre-lex",
+           llvm::cl::desc("Lex the whole input into a token stream before parsing"),
+           llvm::cl::init(false));
+
+// Define a command-line option for lexing and parsing on several threads.
+static llvm::cl::opt<unsigned>
+    Threads("j",
+            llvm::cl::desc("Lex and parse the input on <N> threads"),
+            llvm::cl::value_desc("N"),
+            llvm::cl::init(1));
+
+// Define a command-line option for checking a flattened copy of the AST.
+static llvm::cl::opt<bool>
+    FlatSema("flat-ast",
+             llvm::cl::desc("Run semantic analysis on the flat, index-based AST"),
+             llvm::cl::init(false));
+
+// Define a command-line option for caching checked programs on disk.
+static llvm::cl::opt<std::string>
+    ASTCacheDir("ast-cache",
+                llvm::cl::desc("Reuse checked ASTs stored in <dir>, keyed by a hash of the source"),
+                llvm::cl::value_desc("dir"),
+                llvm::cl::init(""));
+
+// Define a command-line option for recompiling the input file on every change.
+static llvm::cl::opt<bool>
+    Watch("watch",
+          llvm::cl::desc("Recompile the -file input whenever it changes, reparsing only the changed statements"),
+          llvm::cl::init(false));
+
+// Define a command-line option for checking the program while parsing it.
+static llvm::cl::opt<bool>
+    FusedSema("fused-sema",
+              llvm::cl::desc("Run the semantic checks during parsing instead of as a separate pass"),
+              llvm::cl::init(false));
+
+// Define a command-line option for sharing identical expression subtrees.
+static llvm::cl::opt<bool>
+    HashCons("hash-cons",
+             llvm::cl::desc("Build one AST node for all identical expressions while parsing"),
+             llvm::cl::init(false));
+
+// Define a command-line option for the value-range analysis.
+static llvm::cl::opt<bool>
+    ValueRanges("value-ranges",
+                llvm::cl::desc("Use the value ranges of variables to refine arithmetic and drop dead branches"),
+                llvm::cl::init(true));
+
+// Define a command-line option for dead-store elimination.
+static llvm::cl::opt<bool>
+    DeadStores("dse",
+               llvm::cl::desc("Remove assignments and declarations whose values are never read"),
+               llvm::cl::init(false));
+
+// Define a command-line option for common-subexpression elimination.
+static llvm::cl::opt<bool>
+    CSE("cse",
+        llvm::cl::desc("Evaluate each repeated subexpression and comparison once"),
+        llvm::cl::init(false));
+
+// Define a command-line option for the optimization level of the LLVM passes.
+static llvm::cl::opt<char>
+    OptLevel("O",
+             llvm::cl::desc("Optimization level of the LLVM pipeline: -O0, -O1, -O2, -O3, -Os or -Oz (default -O0)"),
+             llvm::cl::Prefix,
+             llvm::cl::init('0'));
+
+// Define a command-line option for running a custom pass pipeline.
+static llvm::cl::opt<std::string>
+    Passes("passes",
+           llvm::cl::desc("Run the LLVM pass pipeline <pipeline> instead of the one of the -O level"),
+           llvm::cl::value_desc("pipeline"),
+           llvm::cl::init(""));
+
+// Define a command-line option for verifying the generated module.
+static llvm::cl::opt<bool>
+    Verify("verify",
+           llvm::cl::desc("Verify the generated module before optimizing it"),
+           llvm::cl::init(false));
+
+// Define a command-line option for executing the program instead of printing it.
+static llvm::cl::opt<bool>
+    Run("run",
+        llvm::cl::desc("Compile the program with the JIT and execute it in-process"),
+        llvm::cl::init(false));
+
+// Define a command-line option for the kind of output.
+static llvm::cl::opt<CodeGen::EmitKind>
+    Emit("emit",
+         llvm::cl::desc("The kind of output"),
+         llvm::cl::values(clEnumValN(CodeGen::EmitLL, "ll", "Textual LLVM IR (default)"),
+                          clEnumValN(CodeGen::EmitBC, "bc", "LLVM bitcode"),
+                          clEnumValN(CodeGen::EmitAsm, "asm", "Assembly for the host"),
+                          clEnumValN(CodeGen::EmitObj, "obj", "Object file for the host")),
+         llvm::cl::init(CodeGen::EmitLL));
+
+// Define a command-line option for the output file.
+static llvm::cl::opt<std::string>
+    OutputFile("o",
+               llvm::cl::desc("Write the output to <filename> ('-' for stdout)"),
+               llvm::cl::value_desc("filename"),
+               llvm::cl::init("-"));
+
+// Define a command-line option for the target CPU.
+static llvm::cl::opt<std::string>
+    MCPU("mcpu",
+         llvm::cl::desc("Generate code for <cpu>, 'native' for the host CPU and its features"),
+         llvm::cl::value_desc("cpu"),
+         llvm::cl::init(""));
+
+// Define a command-line option for the target features.
+static llvm::cl::opt<std::string>
+    MAttr("mattr",
+          llvm::cl::desc("Enable or disable target features, as in +avx2,-sse4.2"),
+          llvm::cl::value_desc("a1,+a2,-a3,..."),
+          llvm::cl::init(""));
+
+// Define a command-line option for executing the program on the bytecode interpreter.
+static llvm::cl::opt<bool>
+    Interpret("interpret",
+              llvm::cl::desc("Execute the program on the bytecode interpreter, without LLVM"),
+              llvm::cl::init(false));
+
+// Define a command-line option for tiered execution.
+static llvm::cl::opt<bool>
+    Tiered("tiered",
+           llvm::cl::desc("Execute the program on the bytecode interpreter and compile its hot loops with the JIT"),
+           llvm::cl::init(false));
+
+// Define a command-line option for the iterations after which a loop is hot.
+static llvm::cl::opt<unsigned>
+    TierThreshold("tier-threshold",
+                  llvm::cl::desc("Compile a loop with -tiered once it has been interpreted for <N> iterations"),
+                  llvm::cl::value_desc("N"),
+                  llvm::cl::init(1000));
+
+// Define a command-line option for comparing the execution engines.
+static llvm::cl::opt<unsigned>
+    BenchEngines("bench-engines",
+                 llvm::cl::desc("Execute the program <N> times with the bytecode interpreter and the JIT and compare"),
+                 llvm::cl::value_desc("N"),
+                 llvm::cl::init(0));
+
+// Define a command-line option for caching compiled output on disk.
+static llvm::cl::opt<std::string>
+    CompileCacheDir("compile-cache",
+                    llvm::cl::desc("Reuse output stored in <dir>, keyed by a hash of the source and the options"),
+                    llvm::cl::value_desc("dir"),
+                    llvm::cl::init(""));
+
+// Define a command-line option for the size of the compile cache.
+static llvm::cl::opt<unsigned>
+    CompileCacheLimit("compile-cache-limit",
+                      llvm::cl::desc("Evict the least recently used outputs beyond <N> MB (0 for no limit)"),
+                      llvm::cl::value_desc("N"),
+                      llvm::cl::init(512));
+
+// Define a command-line option for benchmarking the lexer on its own.
+static llvm::cl::opt<unsigned>
+    BenchLexer("bench-lexer",
+               llvm::cl::desc("Only lex the input <N> times and report the throughput in MB/s"),
+               llvm::cl::value_desc("N"),
+               llvm::cl::init(0));
+
+// Lex the whole source Iterations times and print the lexer throughput.
+static void benchLexer(llvm::StringRef Source, unsigned Iterations)
+{
+    unsigned long long Tokens = 0;
+    SymbolTable Symbols;
+    auto Start = std::chrono::steady_clock::now();
+    for (unsigned I = 0; I < Iterations; ++I)
+    {
+        Lexer Lex(Source, Symbols);
+        Token Tok;
+        do
+        {
+            Lex.next(Tok);
+            ++Tokens;
+        } while (!Tok.is(Token::eoi));
+    }
+    std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now() - Start;
+    double MB = (double)Source.size() * Iterations / (1024.0 * 1024.0);
+    llvm::outs() << "lexed " << MB << " MB (" << Tokens << " tokens) in "
+                 << Elapsed.count() << " s: " << MB / Elapsed.count() << " MB/s\n";
+}
+
+// Define a command-line option for reporting what the AST costs.
+static llvm::cl::opt<bool>
+    ASTStats("ast-stats",
+             llvm::cl::desc("Report the memory the checked AST and its flat form take on stderr"),
+             llvm::cl::init(false));
+
+// Define a command-line option for benchmarking AST visitor dispatch.
+static llvm::cl::opt<unsigned>
+    BenchVisitor("bench-visitor",
+                 llvm::cl::desc("Walk a generated AST of <N> statements with the virtual and the static visitor and compare"),
+                 llvm::cl::value_desc("N"),
+                 llvm::cl::init(0));
+
+// Counts nodes through the virtual accept/visit double dispatch.
+class VirtualCounter : public ASTVisitor
+{
+public:
+    unsigned long long Count = 0;
+
+    virtual void visit(Goal &Node) override
+    {
+        ++Count;
+        for (Statement *S : Node.getStatements())
+            S->accept(*this);
+    }
+    virtual void visit(Statement &) override { ++Count; }
+    virtual void visit(Final &) override { ++Count; }
+    virtual void visit(BinaryOp &Node) override
+    {
+        ++Count;
+        Node.getLeft()->accept(*this);
+        Node.getRight()->accept(*this);
+    }
+    virtual void visit(Condition &Node) override
+    {
+        ++Count;
+        Node.getLeft()->accept(*this);
+        Node.getRight()->accept(*this);
+    }
+    virtual void visit(Declaration &Node) override
+    {
+        ++Count;
+        for (Expr *E : Node.getExprs())
+            E->accept(*this);
+    }
+    virtual void visit(Equation &Node) override
+    {
+        ++Count;
+        Node.getId()->accept(*this);
+        Node.getE()->accept(*this);
+    }
+    virtual void visit(If &Node) override
+    {
+        ++Count;
+        Node.getConditions()->accept(*this);
+        for (Equation *Eq : Node.getEquations())
+            Eq->accept(*this);
+        for (Elif *E : Node.getElifs())
+            E->accept(*this);
+        if (Node.getElsestate())
+            Node.getElsestate()->accept(*this);
+    }
+    virtual void visit(Elif &Node) override
+    {
+        ++Count;
+        Node.getConditions()->accept(*this);
+        for (Equation *Eq : Node.getEquations())
+            Eq->accept(*this);
+    }
+    virtual void visit(Else &Node) override
+    {
+        ++Count;
+        for (Equation *Eq : Node.getEquations())
+            Eq->accept(*this);
+    }
+    virtual void visit(Loop &Node) override
+    {
+        ++Count;
+        Node.getConditions()->accept(*this);
+        for (Equation *Eq : Node.getEquations())
+            Eq->accept(*this);
+    }
+    virtual void visit(C &Node) override
+    {
+        ++Count;
+        Node.getLeft()->accept(*this);
+        Node.getRight()->accept(*this);
+    }
+};
+
+// Counts the same nodes through the kind-tag switch of StaticVisitor.
+class StaticCounter : public RecursiveVisitor<StaticCounter>
+{
+public:
+    unsigned long long Count = 0;
+
+    void visit(AST *Node)
+    {
+        ++Count;
+        RecursiveVisitor::visit(Node);
+    }
+};
+
+// Build a program of Statements loops, each condition and assignment holding
+// a few levels of binary operators, and time a full walk with each visitor.
+static void benchVisitor(unsigned Statements)
+{
+    ASTContext Context;
+    auto Leaf = [&](uint32_t I) { return Context.create<Final>(Final::Id, "x", I % 8); };
+    auto Tree = [&](uint32_t I) {
+        Expr *E = Leaf(I);
+        for (unsigned Depth = 0; Depth < 6; ++Depth)
+            E = Context.create<BinaryOp>((BinaryOp::Operator)(Depth % 5), E, Leaf(I + Depth));
+        return E;
+    };
+    llvm::SmallVector<Statement *, 0> Stmts;
+    for (uint32_t I = 0; I < Statements; ++I)
+    {
+        C *Cond = Context.create<Condition>(Tree(I), Tree(I + 1), Condition::less);
+        Equation *Eqs[] = {Context.create<Equation>(Leaf(I), Tree(I), Equation::equal),
+                           Context.create<Equation>(Leaf(I + 1), Tree(I + 2), Equation::plusequal)};
+        Stmts.push_back(Context.create<Loop>(Cond, Context.copy(llvm::ArrayRef<Equation *>(Eqs))));
+    }
+    Goal *Root = Context.create<Goal>(Context.copy(Stmts));
+
+    auto Time = [](auto Walk) {
+        auto Start = std::chrono::steady_clock::now();
+        unsigned long long Count = Walk();
+        std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now() - Start;
+        return std::make_pair(Count, Elapsed.count());
+    };
+    auto Virtual = Time([&] {
+        VirtualCounter V;
+        Root->accept(V);
+        return V.Count;
+    });
+    auto Static = Time([&] {
+        StaticCounter V;
+        V.visit(Root);
+        return V.Count;
+    });
+    llvm::outs() << "virtual visitor: " << Virtual.first << " nodes in " << Virtual.second << " s\n"
+                 << "static visitor:  " << Static.first << " nodes in " << Static.second << " s\n";
+}
+
+// Execute the checked program once to read its input, then Iterations times
+// with each engine, replaying that input, and print the average time per
+// execution. Compiling is part of every execution, as it is for a program
+// run once.
+static bool benchEngines(AST *Tree, const SymbolTable &Symbols, CodeGen &CodeGenerator,
+                         unsigned Iterations)
+{
+    bytecode::execute(bytecode::compile(Tree, Symbols));
+    runtime::replay();
+
+    using Clock = std::chrono::steady_clock;
+    std::chrono::duration<double, std::milli> Compile(0), Execute(0), JIT(0), Tier(0);
+    for (unsigned I = 0; I < Iterations; ++I)
+    {
+        runtime::replay();
+        auto Start = Clock::now();
+        bytecode::Program Prog = bytecode::compile(Tree, Symbols);
+        auto Compiled = Clock::now();
+        bytecode::execute(Prog);
+        Compile += Compiled - Start;
+        Execute += Clock::now() - Compiled;
+    }
+    for (unsigned I = 0; I < Iterations; ++I)
+    {
+        runtime::replay();
+        auto Start = Clock::now();
+        int ExitCode;
+        if (!CodeGenerator.run(Tree, Symbols, ExitCode))
+            return false;
+        JIT += Clock::now() - Start;
+    }
+    for (unsigned I = 0; I < Iterations; ++I)
+    {
+        runtime::replay();
+        auto Start = Clock::now();
+        TieredEngine Engine(CodeGenerator, Tree, Symbols, TierThreshold);
+        Engine.execute();
+        Tier += Clock::now() - Start;
+    }
+    llvm::outs() << "bytecode: " << (Compile + Execute).count() / Iterations << " ms per execution ("
+                 << Compile.count() / Iterations << " ms compiling, "
+                 << Execute.count() / Iterations << " ms executing)\n"
+                 << "llvm jit: " << JIT.count() / Iterations << " ms per execution\n"
+                 << "tiered:   " << Tier.count() / Iterations << " ms per execution\n";
+    return true;
+}
+
+// The front-end passes that change the generated code, to key the compile
+// cache with.
+static std::string getFrontEndKey()
+{
+    std::string Key;
+    llvm::raw_string_ostream OS(Key);
+    OS << " value-ranges " << ValueRanges << " dse " << DeadStores << " cse " << CSE
+       << " hash-cons " << HashCons;
+    return OS.str();
+}
+
+// Configure the LLVM passes and the output from the command line. Returns
+// false for an unknown -O level.
+static bool configure(CodeGen &CodeGenerator)
+{
+    switch (OptLevel)
+    {
+        case '0':
+        case '1':
+        case '2':
+        case '3':
+            CodeGenerator.setOptLevel(OptLevel - '0');
+            break;
+        case 's':
+            CodeGenerator.setOptLevel(2, 1);
+            break;
+        case 'z':
+            CodeGenerator.setOptLevel(2, 2);
+            break;
+        default:
+            llvm::errs() << "Unknown optimization level -O" << OptLevel << "\n";
+            return false;
+    }
+    CodeGenerator.setPasses(Passes);
+    CodeGenerator.setVerify(Verify);
+    CodeGenerator.setEmit(Emit);
+    CodeGenerator.setOutput(OutputFile);
+    CodeGenerator.setTarget(MCPU, MAttr);
+    return true;
+}
+
+// Run the enabled passes over a checked tree, rewriting it in place.
+static void runPasses(AST *Tree, const SymbolTable &Symbols, ASTContext &Context)
+{
+    // Annotate the checked tree with what the value ranges prove.
+    if (ValueRanges)
+    {
+        RangeAnalysis Ranges;
+        Ranges.analyze(Tree, Symbols, Context);
+    }
+
+    // Drop the stores no later statement reads before LLVM sees them.
+    if (DeadStores)
+    {
+        Optimization Optimizer;
+        Optimizer.Optimize(Tree, Symbols, Context);
+    }
+
+    // Link repeated evaluations to the first one, after every pass that
+    // removes statements.
+    if (CSE)
+    {
+        ValueNumbering Numbering;
+        Numbering.number(Tree, Symbols);
+    }
+}
+
+// Poll Path and recompile it after every change until interrupted. The front
+// end state carries over from one version to the next, the passes run on a
+// copy of each version.
+static int watch(llvm::StringRef Path)
+{
+    IncrementalCompiler Compiler;
+    llvm::sys::TimePoint<> LastModified;
+    for (;;)
+    {
+        llvm::sys::fs::file_status Status;
+        if (!llvm::sys::fs::status(Path, Status) && Status.getLastModificationTime() != LastModified)
+        {
+            LastModified = Status.getLastModificationTime();
+            llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> FileOrErr =
+                llvm::MemoryBuffer::getFile(Path, /*IsText=*/false,
+                                            /*RequiresNullTerminator=*/false);
+            if (std::error_code EC = FileOrErr.getError())
+            {
+                llvm::errs() << "Could not open " << Path << ": " << EC.message() << "\n";
+                return 1;
+            }
+
+            auto Start = std::chrono::steady_clock::now();
+            bool Ok = Compiler.update((*FileOrErr)->getBuffer());
+            std::chrono::duration<double, std::milli> Elapsed = std::chrono::steady_clock::now() - Start;
+            llvm::errs() << "reparsed " << Compiler.getReparsed() << " of "
+                         << Compiler.getStatementCount() << " statements in "
+                         << Elapsed.count() << " ms\n";
+
+            if (Ok)
+            {
+                CodeGen CodeGenerator;
+                if (!configure(CodeGenerator))
+                    return 1;
+                ASTContext Scratch;
+                Goal *Tree = Compiler.snapshot(Scratch);
+                const SymbolTable &Symbols = Compiler.getSymbols();
+                runPasses(Tree, Symbols, Scratch);
+                int ExitCode;
+                if (Interpret)
+                    bytecode::execute(bytecode::compile(Tree, Symbols));
+                else if (Tiered)
+                    TieredEngine(CodeGenerator, Tree, Symbols, TierThreshold).execute();
+                else if (Run)
+                    CodeGenerator.run(Tree, Symbols, ExitCode);
+                else
+                    CodeGenerator.compile(Tree, Symbols);
+            }
+            else
+                llvm::errs() << "Errors occurred\n";
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+}
+
 // The main function of the program.
 int main(int argc, const char **argv)
 {
@@ -20,33 +546,183 @@ int main(int argc, const char **argv)
     // Parse command-line options.
     llvm::cl::ParseCommandLineOptions(argc, argv, "GSM - the expression compiler\n");
 
-    // Create a lexer object and initialize it with the input expression.
-    Lexer Lex(Input);
+    if (Watch)
+    {
+        if (InputFile.empty() || InputFile == "-")
+        {
+            llvm::errs() << "-watch needs an input -file\n";
+            return 1;
+        }
+        // Watch mode parses and checks statement by statement itself.
+        if (Threads > 1 || PreLex || FusedSema || HashCons || !ASTCacheDir.empty())
+        {
+            llvm::errs() << "-watch cannot be combined with -j, -pre-lex, -fused-sema, -hash-cons or -ast-cache\n";
+            return 1;
+        }
+        return watch(InputFile);
+    }
 
-    // Create a parser object and initialize it with the lexer.
-    Parser Parser(Lex);
+    // Map the input file if one was given, otherwise lex the command-line string.
+    // The buffer is kept alive until the end of main since tokens point into it.
+    std::unique_ptr<llvm::MemoryBuffer> FileBuf;
+    llvm::StringRef Source = Input;
+    if (!InputFile.empty())
+    {
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> FileOrErr =
+            llvm::MemoryBuffer::getFileOrSTDIN(InputFile, /*IsText=*/false,
+                                               /*RequiresNullTerminator=*/false);
+        if (std::error_code EC = FileOrErr.getError())
+        {
+            llvm::errs() << "Could not open " << InputFile << ": " << EC.message() << "\n";
+            return 1;
+        }
+        FileBuf = std::move(*FileOrErr);
+        Source = FileBuf->getBuffer();
+    }
 
-    // Parse the input expression and generate an abstract syntax tree (AST).
-    AST *Tree = Parser.parse();
+    if (BenchVisitor)
+    {
+        benchVisitor(BenchVisitor);
+        return 0;
+    }
 
-    // Check if parsing was successful or if there were any syntax errors.
-    if (!Tree || Parser.hasError())
+    if (BenchLexer)
     {
-        llvm::errs() << "Syntax errors occurred\n";
+        benchLexer(Source, BenchLexer);
+        return 0;
+    }
+
+    // The code generator is configured up front, its options are part of the
+    // compile cache key.
+    CodeGen CodeGenerator;
+    if (!configure(CodeGenerator))
         return 1;
+
+    // Output cached for the same source and options is written out as is,
+    // a hit skips the front end and the code generator.
+    CompileCache OutputCache(CompileCacheDir, (uint64_t)CompileCacheLimit << 20);
+    bool UseOutputCache = !CompileCacheDir.empty() && !Run && !Interpret && !Tiered && !BenchEngines;
+    std::string CacheKey;
+    if (UseOutputCache)
+    {
+        CacheKey = CodeGenerator.getCacheKey() + getFrontEndKey();
+        llvm::SmallString<0> Cached;
+        if (OutputCache.load(Source, CacheKey, Cached))
+            return CodeGenerator.write(Cached) ? 0 : 1;
     }
 
-    // Perform semantic analysis on the AST.
-    Sema Semantic;
-    if (Semantic.semantic(Tree))
+    // Identifiers are interned into this table while lexing, every later phase
+    // refers to variables by their symbol ID.
+    SymbolTable Symbols;
+
+    // Every AST node is allocated in this context and freed with it at the end.
+    ASTContext Context;
+
+    // A cached tree was checked when it was stored, a hit skips the whole
+    // front end.
+    ASTCache Cache(ASTCacheDir);
+    AST *Tree = nullptr;
+    if (!ASTCacheDir.empty())
+        Tree = Cache.load(Source, Symbols, Context);
+    if (!Tree)
     {
-        llvm::errs() << "Semantic errors occurred\n";
-        return 1;
+        bool SyntaxError = false;
+        bool Checked = false;
+        bool SemanticError = false;
+        if (Threads > 1)
+        {
+            // Split the input at top-level statements and parse the pieces concurrently.
+            ParallelParser Parallel(Source, Threads, Symbols, Context);
+            Parallel.setHashCons(HashCons);
+            Tree = Parallel.parse();
+            SyntaxError = Parallel.hasError();
+        }
+        else
+        {
+            // Create a lexer object and initialize it with the input expression.
+            Lexer Lex(Source, Symbols);
+
+            // Optionally lex everything up front so the parser reads a token stream.
+            TokenStream Tokens;
+            if (PreLex && !Lex.lexAll(Tokens))
+                return 1;
+
+            // Create a parser object and initialize it with the lexer or the token stream.
+            Parser P = PreLex ? Parser(Tokens, Context) : Parser(Lex, Context);
+
+            // The parser sees the whole program in order, so it can also check it.
+            P.setCheckSemantics(FusedSema);
+            P.setHashCons(HashCons);
+
+            // Parse the input expression and generate an abstract syntax tree (AST).
+            Tree = P.parse();
+            SyntaxError = P.hasError();
+            Checked = FusedSema;
+            SemanticError = P.hasSemanticError();
+        }
+
+        // Check if parsing was successful or if there were any syntax errors.
+        if (!Tree || SyntaxError)
+        {
+            llvm::errs() << "Syntax errors occurred\n";
+            return 1;
+        }
+
+        // Perform semantic analysis on the AST unless the parser already did.
+        Sema Semantic;
+        if (!Checked)
+            SemanticError = FlatSema ? Semantic.semantic(FlatAST::flatten(Tree), Symbols)
+                                     : Semantic.semantic(Tree, Symbols);
+        if (SemanticError)
+        {
+            llvm::errs() << "Semantic errors occurred\n";
+            return 1;
+        }
+
+        if (!ASTCacheDir.empty())
+            Cache.store(Source, FlatAST::flatten(Tree), Symbols);
     }
 
-    // Generate code for the AST using a code generator.
-    CodeGen CodeGenerator;
-    CodeGenerator.compile(Tree);
+    if (ASTStats)
+    {
+        FlatAST Flat = FlatAST::flatten(Tree);
+        llvm::errs() << "AST: " << Context.getTotalMemory() << " bytes in the ASTContext\n"
+                     << "flat AST: " << Flat.size() << " nodes in " << Flat.getMemory() << " bytes\n";
+    }
+
+    runPasses(Tree, Symbols, Context);
+
+    if (BenchEngines)
+        return benchEngines(Tree, Symbols, CodeGenerator, BenchEngines) ? 0 : 1;
+
+    // An executed program exits with what its main returned.
+    if (Interpret)
+        return bytecode::execute(bytecode::compile(Tree, Symbols));
+    if (Tiered)
+    {
+        TieredEngine Engine(CodeGenerator, Tree, Symbols, TierThreshold);
+        return Engine.execute();
+    }
+    if (Run)
+    {
+        int ExitCode;
+        if (!CodeGenerator.run(Tree, Symbols, ExitCode))
+            return 1;
+        return ExitCode;
+    }
+
+    // Generate code for the AST using the code generator, keeping a copy in
+    // the cache.
+    if (UseOutputCache)
+    {
+        llvm::SmallString<0> Result;
+        if (!CodeGenerator.compile(Tree, Symbols, Result))
+            return 1;
+        OutputCache.store(Source, CacheKey, Result);
+        return CodeGenerator.write(Result) ? 0 : 1;
+    }
+    if (!CodeGenerator.compile(Tree, Symbols))
+        return 1;
 
     // The program executed successfully.
     return 0;
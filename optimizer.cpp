@@ -1,99 +1,215 @@
-#include "AST.h"
-#include "llvm/Support/CommandLine.h"
-#include "llvm/Support/InitLLVM.h"
-#include "llvm/Support/raw_ostream.h"
+#include "optimizer.h"
+#include "StaticVisitor.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include <algorithm>
 
 
-class OptVisitor : public ASTVisitor {
+// Walks the statements backwards. Visiting a statement returns what is left
+// of it, null when it is dead; visiting an expression marks what it reads.
+class OptVisitor : public StaticVisitor<OptVisitor, Statement *> {
 
-    std::vector<llvm::StringRef> alive;
-    std::vector<llvm::StringRef> aliveDec;
-    bool b;
+    ASTContext &Context;
+    llvm::BitVector alive;      // indexed by symbol ID, read before written again
+    llvm::BitVector aliveDec;   // mentioned by a kept statement, so its declaration stays
+    Final *zero;
+
+    // Backward pass over a block. Returns false if every equation is kept.
+    bool equations(llvm::ArrayRef<Equation *> eqs, llvm::SmallVectorImpl<Equation *> &kept) {
+        kept.clear();
+        for (auto I = eqs.rbegin(), E = eqs.rend(); I != E; ++I) {
+            if (visit(*I))
+                kept.push_back(*I);
+        }
+        std::reverse(kept.begin(), kept.end());
+        return kept.size() != eqs.size();
+    }
+
+    llvm::ArrayRef<Equation *> keep(llvm::ArrayRef<Equation *> eqs, llvm::SmallVectorImpl<Equation *> &kept) {
+        return kept.size() == eqs.size() ? eqs : Context.copy(kept);
+    }
 
     public:
-    OptVisitor(){
-        alive.push_back(llvm::StringRef("result"));
-        aliveDec.push_back(llvm::StringRef("result"));
+    OptVisitor(const SymbolTable &Symbols, ASTContext &Context) : Context(Context), zero(nullptr) {
+        alive.resize(Symbols.size());
+        aliveDec.resize(Symbols.size());
+        uint32_t Result = Symbols.lookup("result");
+        if (Result != SymbolTable::NotFound) {
+            alive.set(Result);
+            aliveDec.set(Result);
+        }
     }
 
-    
-    virtual void visit(Statement &Node) {}
-    virtual void visit(IfStatement &Node) {}
-    virtual void visit(ElifStatement &Node) {}
-    virtual void visit(ElseStatement &Node) {}
-    virtual void visit(Condition &Node) {}
-    virtual void visit(LoopStatement &Node) {}
-    virtual void visit(Conditions &Node) {}
-    
-    virtual void visit(MSM &msm){
-        auto v = msm.getStatements();
-        auto end = v.end();
-        auto begin = v.begin();
-        do {
-            end--;
-            (*end)->accept(*this);
-            if(b){
-                v.erase(end);
-            }
-        } while(end != begin);
-        
-        msm.setStatements(v);
+    Statement *visitGoal(Goal &goal){
+        llvm::SmallVector<Statement *, 16> kept;
+        llvm::ArrayRef<Statement *> v = goal.getStatements();
+        for (auto I = v.rbegin(), E = v.rend(); I != E; ++I) {
+            if (Statement *S = visit(*I))
+                kept.push_back(S);
+        }
+        if (kept.size() != v.size() || !std::equal(kept.rbegin(), kept.rend(), v.begin())) {
+            std::reverse(kept.begin(), kept.end());
+            goal.setStatements(Context.copy(kept));
+        }
+        return nullptr;
+    }
+
+    Statement *visitEquation(Equation &statement){
+        uint32_t lValue = statement.getId()->getSymbol();
+        if(!alive.test(lValue))
+            return nullptr;
+        if(statement.getOp() == Equation::equal)
+            alive.reset(lValue);
+        else
+            alive.set(lValue);
+        aliveDec.set(lValue);
+        visit(statement.getE());
+        return &statement;
     }
 
-    virtual void visit(AssignStatement &statement){
-        Final* lValue = statement.getLValue();
-        auto findItr = find(alive.begin(), alive.end(), lValue->getVal());
-        if(findItr != alive.end()){
-            if(statement.getAssignmentOP() == AssignStatement::AssOp::Assign){
-                alive.erase(findItr);
+    // Variables read from the input stay, reading is visible. A dead
+    // initializer is dropped with its variable, or replaced by 0 while a
+    // kept assignment still needs the variable.
+    Statement *visitDeclaration(Declaration &statement){
+        llvm::ArrayRef<uint32_t> vars = statement.getVars();
+        llvm::ArrayRef<Expr *> exprs = statement.getExprs();
+        llvm::SmallVector<uint32_t, 4> keptVars;
+        llvm::SmallVector<Expr *, 4> keptExprs;
+        bool changed = false;
+        for (size_t i = vars.size(); i-- > 0;) {
+            uint32_t var = vars[i];
+            if (i >= exprs.size() || alive.test(var)) {
+                alive.reset(var);
+                keptVars.push_back(var);
+                if (i < exprs.size()) {
+                    visit(exprs[i]);
+                    keptExprs.push_back(exprs[i]);
+                }
+            } else if (aliveDec.test(var)) {
+                keptVars.push_back(var);
+                Final *F = llvm::dyn_cast<Final>(exprs[i]);
+                if (F && F->getKind() == Final::Num) {
+                    keptExprs.push_back(F);
+                } else {
+                    if (!zero)
+                        zero = Context.create<Final>(Final::Num, "0", 0);
+                    keptExprs.push_back(zero);
+                    changed = true;
+                }
+            } else {
+                changed = true;
             }
-            statement.getRValue()->accept(*this);
-            b = false;
-            return;
         }
-        b =  true;
+        if (!changed)
+            return &statement;
+        if (keptVars.empty())
+            return nullptr;
+        std::reverse(keptVars.begin(), keptVars.end());
+        std::reverse(keptExprs.begin(), keptExprs.end());
+        return Context.create<Declaration>(Context.copy(keptVars), Context.copy(keptExprs));
     }
 
-    virtual void visit(DecStatement &statement){
-        llvm::StringRef lValue = *(statement.getVars().begin());
-        auto findItr = find(alive.begin(), alive.end(), lValue);
-        if(findItr != alive.end()){
-            llvm::errs() << lValue;
-            alive.erase(findItr);
-            auto rightV = *(statement.getExprs().begin());
-            rightV->accept(*this);
-            b = false;
-            return;
+    // Each arm starts from what is live after the if, what is live before
+    // it is the union over the arms plus what the conditions read. An if
+    // with nothing left in any arm is dropped with its conditions.
+    Statement *visitIf(If &statement){
+        llvm::BitVector out = alive;
+        llvm::SmallVector<Equation *, 8> kept;
+        bool changed = false;
+        bool empty = true;
+
+        Else *els = statement.getElsestate();
+        if (els) {
+            changed |= equations(els->getEquations(), kept);
+            if (kept.empty())
+                els = nullptr;
+            else if (changed)
+                els = Context.create<Else>(Context.copy(kept));
+            empty &= kept.empty();
+        }
+        llvm::BitVector in = alive;
+
+        llvm::ArrayRef<Elif *> elifs = statement.getElifs();
+        llvm::SmallVector<Elif *, 4> keptElifs(elifs.begin(), elifs.end());
+        for (size_t i = elifs.size(); i-- > 0;) {
+            alive = out;
+            if (equations(elifs[i]->getEquations(), kept)) {
+                keptElifs[i] = Context.create<Elif>(elifs[i]->getConditions(), Context.copy(kept));
+                changed = true;
+            }
+            empty &= kept.empty();
+            in |= alive;
+        }
+
+        alive = out;
+        changed |= equations(statement.getEquations(), kept);
+        empty &= kept.empty();
+        if (empty) {
+            alive = out;
+            return nullptr;
         }
-        
-        if(find(aliveDec.begin(), aliveDec.end(), lValue) == aliveDec.end())
-            b = true;
-        else 
-            b = false;
+        alive |= in;
+
+        visit(statement.getConditions());
+        for (Elif *E : elifs)
+            visit(E->getConditions());
+        if (!changed)
+            return &statement;
+        return Context.create<If>(statement.getConditions(), keep(statement.getEquations(), kept),
+                                  Context.copy(keptElifs), els);
     }
-    
-    virtual void visit(Expression &statement){
-        auto LValue = statement.getLeft();
-        auto RValue = statement.getRight();
 
-        LValue->accept(*this);
+    // Live at the head is what is live after the loop, what the condition
+    // reads and what the body reads from an earlier iteration, so the body
+    // is walked until that stops growing. The loop stays even when its body
+    // empties, it may never end.
+    Statement *visitLoop(Loop &statement){
+        llvm::SmallVector<Equation *, 8> kept;
+        visit(statement.getConditions());
+        llvm::BitVector head = alive;
+        for (;;) {
+            equations(statement.getEquations(), kept);
+            alive |= head;
+            if (alive == head)
+                break;
+            head = alive;
+        }
+        if (!equations(statement.getEquations(), kept)) {
+            alive = head;
+            return &statement;
+        }
+        alive = head;
+        return Context.create<Loop>(statement.getConditions(), keep(statement.getEquations(), kept));
+    }
 
-        RValue->accept(*this);
-        
+    Statement *visitBinaryOp(BinaryOp &statement){
+        visit(statement.getLeft());
+        visit(statement.getRight());
+        return nullptr;
     }
-    
-    virtual void visit(Final &statement){
-        if(statement.getKind() == Final::ValueKind::Ident){
-            alive.push_back(statement.getVal());
-            aliveDec.push_back(statement.getVal());
+
+    Statement *visitFinal(Final &statement){
+        if(statement.getKind() == Final::Id){
+            alive.set(statement.getSymbol());
+            aliveDec.set(statement.getSymbol());
         }
+        return nullptr;
     }
-};
 
-class Optimization{
-    public:
-    void Optimize(AST *Tree) {
-        OptVisitor Op;
-        Tree->accept(Op);
+    Statement *visitC(C &statement){
+        visit(statement.getLeft());
+        visit(statement.getRight());
+        return nullptr;
     }
-};
\ No newline at end of file
+
+    Statement *visitCondition(Condition &statement){
+        visit(statement.getLeft());
+        visit(statement.getRight());
+        return nullptr;
+    }
+};
+
+void Optimization::Optimize(AST *Tree, const SymbolTable &Symbols, ASTContext &Context) {
+    OptVisitor Op(Symbols, Context);
+    Op.visit(Tree);
+}
@@ -0,0 +1,16 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "AST.h"
+#include "ASTContext.h"
+#include "SymbolTable.h"
+
+// Dead-store and dead-declaration elimination on a checked tree, driven by
+// backward liveness of the variables. The final value of 'result' is the
+// only output, reading a variable from the input is always kept.
+class Optimization{
+    public:
+    void Optimize(AST *Tree, const SymbolTable &Symbols, ASTContext &Context);
+};
+
+#endif
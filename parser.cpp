@@ -1,4 +1,44 @@
-#include "Parser.h"
+#include "parser.h"
+#include "llvm/Support/Casting.h"
+#include <algorithm>
+
+namespace {
+// Infix operators indexed by token kind. Prec 0 marks tokens that are not
+// infix operators. Comparisons bind loosest, they end an arithmetic
+// expression and are only accepted by parseCondition, so they never chain.
+struct InfixOperator
+{
+    uint8_t Prec;
+    bool RightAssoc;
+    bool IsComparison;
+    uint8_t Op;         // BinaryOp::Operator or Condition::OperatorCondition
+};
+
+struct InfixTable
+{
+    InfixOperator Ops[Token::KW_loopc + 1];
+};
+
+constexpr InfixTable buildInfixTable()
+{
+    InfixTable T{};
+    T.Ops[Token::greater] = {1, false, true, Condition::greater};
+    T.Ops[Token::less] = {1, false, true, Condition::less};
+    T.Ops[Token::greaterequal] = {1, false, true, Condition::greaterequal};
+    T.Ops[Token::lessequal] = {1, false, true, Condition::lessequal};
+    T.Ops[Token::equalequal] = {1, false, true, Condition::equalequal};
+    T.Ops[Token::notequal] = {1, false, true, Condition::notequal};
+    T.Ops[Token::plus] = {2, false, false, BinaryOp::plus};
+    T.Ops[Token::minus] = {2, false, false, BinaryOp::minus};
+    T.Ops[Token::star] = {3, false, false, BinaryOp::star};
+    T.Ops[Token::slash] = {3, false, false, BinaryOp::slash};
+    T.Ops[Token::percent] = {3, false, false, BinaryOp::percent};
+    T.Ops[Token::power] = {4, true, false, BinaryOp::pow};
+    return T;
+}
+
+constexpr InfixTable InfixOperators = buildInfixTable();
+}
 
 AST *Parser::parse()
 {
@@ -6,411 +46,418 @@ AST *Parser::parse()
     return Res;
 }
 
-AST *Parser::parseGoal()
+Goal *Parser::parseGoal()
+{
+    llvm::SmallVector<Statement *> Statements;
+    parseStatements(Statements);
+    if (HasError)
+        return nullptr;
+    return Context.create<Goal>(Context.copy(Statements));
+}
+
+void Parser::parseStatements(llvm::SmallVector<Statement *> &Statements)
 {
-    llvm::SmallVector <Expr *> exprs;
-    while(!Tok.is(Token::eoi))
+    while (!Tok.is(Token::eoi))
     {
-        switch (Tok.getKind())
-        {
-            case Token::KW_int:
-                Expr *d1;
-                d1 = parseDec();
-                if (d1)
-                    exprs.push_back(d1);
-                else
-                    goto _error;
-                break;
-
-                if (!Tok.is(Token::semicolon))
-                    goto _error;
-            
-            case Token::ident:
-                Expr *d2;
-                d2 = parseEquation();
-                if (d2):
-                    exprs.push_back();
-                else
-                    goto _error;
-                break;
-
-                if(!Tok.is(Token::semicolon))
-                    goto _error;
-            case Token::KW_loopc:
-                Expr *d3;
-                d3 = parseLoop();
-                if (d3)
-                    exprs.push_back(d3);
-                else
-                    goto _error;
-                break;
-                //
-                //
-
-            case Token::KW_if:
-                Expr *d4;
-                d4 = parseIf();
-                if (d4)
-                    exprs.push_back(d4);
-                else
-                    goto _error;
-                break;
-                //
-                //
-
-            default:
-                goto _error;
-                break;
-        }
-        advance();
+        Statement *S = parseStatement();
+        if (!S)
+            return;
+        Statements.push_back(S);
     }
-    return new NAN(exprs);
+}
 
+Statement *Parser::parseStatement()
+{
+    switch (Tok.getKind())
+    {
+        case Token::KW_int:
+            return parseDec();
+        case Token::ident:
+            return parseEquation();
+        case Token::KW_loopc:
+            return parseLoop();
+        case Token::KW_if:
+            return parseIf();
+        default:
+            error();
+            skipToEnd();
+            return nullptr;
+    }
 }
 
-Expr *Parser::parseDec() //check
+Declaration *Parser::parseDec()
 {
-    Expr *E;
-    llvm::SmallVector<llvm::StringRef, 8> Vars;
-    if (!Tok.is(Token::KW_int) && !(Tok.is(Token::ident)))
-        goto _error;
-    advance();
-    
-    if (expect(Token::KW_int))
+    llvm::SmallVector<uint32_t, 8> Vars;
+    llvm::SmallVector<llvm::StringRef, 8> Names;
+    llvm::SmallVector<Expr *> Exprs;
+
+    // Each variable comes into scope right after its own initializer.
+    unsigned Declared = 0;
+    auto declareUpTo = [&](size_t N) {
+        for (N = std::min(N, Vars.size()); Declared < N; ++Declared)
+            declare(Names[Declared], Vars[Declared]);
+    };
+
+    if (consume(Token::KW_int))
         goto _error;
-    advance();
 
     if (expect(Token::ident))
         goto _error;
-    Vars.push_back(Tok.getText());
+    Vars.push_back(Tok.getSymbol());
+    Names.push_back(Tok.getText());
+    advance();
 
     while (Tok.is(Token::comma))
     {
         advance();
         if (expect(Token::ident))
             goto _error;
-        Vars.push_back(Tok.getText());
+        Vars.push_back(Tok.getSymbol());
+        Names.push_back(Tok.getText());
         advance();
     }
 
     if (Tok.is(Token::equal))
     {
-        advance();
-        E = parseExpr();
+        do
+        {
+            advance();
+            if (CheckSemantics)
+                declareUpTo(Exprs.size());
+            // Initializers beyond the variables are never checked or used
+            // by Sema, so they are not checked here either.
+            bool Check = CheckSemantics;
+            CheckSemantics = Check && Exprs.size() < Vars.size();
+            Expr *E = parseExpr();
+            CheckSemantics = Check;
+            if (!E)
+                goto _error;
+            Exprs.push_back(E);
+        } while (Tok.is(Token::comma));
     }
 
-    if (expect(Token::semicolon))
+    if (consume(Token::semicolon))
         goto _error;
 
-    // return new Declaration(Vars, E);
+    if (CheckSemantics)
+        declareUpTo(Vars.size());
+    return Context.create<Declaration>(Context.copy(Vars), Context.copy(Exprs));
 _error:
-    while(Tok.getKind() != Token::eoi)
-        advance();
+    skipToEnd();
     return nullptr;
 }
 
-Expr *parseEquation()
+Equation *Parser::parseEquation()
 {
+    Final *Id;
     Expr *E;
-    BinaryOp::Operator Op;
-    if (!Tok.is(Token::ident))
+    Equation::Operator Op;
+
+    if (expect(Token::ident))
         goto _error;
+    Id = Context.create<Final>(Final::Id, Tok.getText(), Tok.getSymbol());
+    if (CheckSemantics)
+        checkUse(Tok.getText(), Tok.getSymbol());
+    advance();
+
+    switch (Tok.getKind())
+    {
+        case Token::equal:
+            Op = Equation::equal;
+            break;
+        case Token::plusequal:
+            Op = Equation::plusequal;
+            break;
+        case Token::minusequal:
+            Op = Equation::minusequal;
+            break;
+        case Token::starequal:
+            Op = Equation::starequal;
+            break;
+        case Token::slashequal:
+            Op = Equation::slashequal;
+            break;
+        case Token::percentequal:
+            Op = Equation::percentequal;
+            break;
+        default:
+            error();
+            goto _error;
+    }
     advance();
 
-    while (Tok.isOneOf(Token::plus, Token::minus , Token::equal, Token::power, Token::star, Token::slash , Token::KW_mod, Token::KW_plusEqual, Token::KW_minusEqual ,Token::KW_starEqual ,Token::KW_slashEqual , Token::KW_modEq)){
-    
-        //Tok.is(Token::star) ? BinaryOp::star : BinaryOp::slash;
-        if (Tok.is(Token::plus)) 
-            Op = BinaryOp::Operator::plus;
-        else if (Tok.is(Token::minus))  
-            Op =  BinaryOp::Operator::minus;
-        else if (Tok.is(Token::equal))  
-            Op =  BinaryOp::Operator::equal;
-        else if (Tok.is(Token::power))  
-            Op =  BinaryOp::Operator::power;
-        else if (Tok.is(Token::star))  
-            Op =  BinaryOp::Operator::star;
-        else if (Tok.is(Token::slash))  
-            Op =  BinaryOp::Operator::slash;
-        else if (Tok.is(Token::KW_mod))  
-            Op =  BinaryOp::Operator::KW_mod; 
-        else if (Tok.is(Token::KW_plusEqual))  
-            Op =  BinaryOp::Operator::KW_plusEqual;   
-        else if (Tok.is(Token::KW_minusEqual))  
-            Op =  BinaryOp::Operator::KW_minusEqual;   
-        else if (Tok.is(Token::KW_starEqual))  
-            Op =  BinaryOp::Operator::KW_starEqual;   
-        else if (Tok.is(Token:: KW_slashEqual))  
-            Op =  BinaryOp::Operator::KW_slashEqual; 
-        else if (Tok.is(Token:: KW_modEq))  
-            Op =  BinaryOp::Operator::KW_modEq;
-    } 
     E = parseExpr();
-    
-    if (expect(Token::semicolon))
+    if (!E)
+        goto _error;
+
+    if (consume(Token::semicolon))
         goto _error;
 
-    return new Equation(Op,E); //MUST EDIT AST
+    return Context.create<Equation>(Id, E, Op);
+_error:
+    skipToEnd();
+    return nullptr;
 }
 
-Expr *Parser::parseExpr()
+// A number keeps the text of its first occurrence, a shared leaf is only
+// told apart by its value.
+Final *Parser::makeFinal(Final::ValueKind Kind, llvm::StringRef Text, uint32_t Value)
 {
-    Expr *Left = parseTerm();
-    while (Tok.isOneOf(Token::plus, Token::minus))
-    {
-        BinaryOp::Operator Op = Tok.is(Token::plus) ? BinaryOp::Plus : BinaryOp::Minus;
-        advance();
-        Expr *Right = parseTerm();
-        Left = new BinaryOp(Op, Left, Right);
-    }
-    return Left;
+    if (!HashCons)
+        return Context.create<Final>(Kind, Text, Value);
+    Final *&Node = Leaves[{Kind, Value}];
+    if (Node)
+        Node->setShared();
+    else
+        Node = Context.create<Final>(Kind, Text, Value);
+    return Node;
 }
 
-Expr *Parser::parseTerm()
+// The operands are hash-consed already, so comparing them by address
+// compares the whole subtrees.
+BinaryOp *Parser::makeBinaryOp(BinaryOp::Operator Op, Expr *Left, Expr *Right)
 {
-    Expr *Left = parseFactor();
-    while (Tok.isOneOf(Token::star, Token::slash , Token::KW_mod))
-    {
-        BinaryOp::Operator Op;
-            //Tok.is(Token::star) ? BinaryOp::star : BinaryOp::slash;
-            if (Tok.is(Token::star)) 
-                Op = BinaryOp::Operator::star;
-            else if (Tok.is(Token::slash))  
-                Op =  BinaryOp::Operator::slash;
-            else if (Tok.is(Token::KW_mod))  
-                Op =  BinaryOp::Operator::percent;  
-        advance();
-        Expr *Right = parseFactor();
-        Left = new BinaryOp(Op, Left, Right);
-    }
-    return Left;
+    if (!HashCons)
+        return Context.create<BinaryOp>(Op, Left, Right);
+    BinaryOp *&Node = Operations[{Op, {Left, Right}}];
+    if (Node)
+        Node->setShared();
+    else
+        Node = Context.create<BinaryOp>(Op, Left, Right);
+    return Node;
 }
 
-Expr *Parser::parseFinal()
+// Expressions are parsed by precedence climbing driven by the operator table
+// below. Operands and pending operators live on explicit stacks, and an open
+// parenthesis is just a marker on the operator stack, so nesting depth is
+// limited only by memory and no token costs more than a constant number of
+// calls.
+Expr *Parser::parseExpr()
 {
-    Expr *Res = nullptr;
-    switch (Tok.getKind())
+    struct Pending
     {
-    case Token::num:
-        Res = new Factor(Final::num, Tok.getText());
-        advance();
-        break;
-    case Token::id:
-        Res = new Factor(Final::id, Tok.getText());
-        advance();
-        break;
-    case Token::l_paren:
-        advance();
-        Res = parseExpr();
-        if (!consume(Token::r_paren))
-            break;
-    default: // error handling
-        if (!Res)
-            error();
-        while (!Tok.isOneOf(Token::r_paren, Token::star, Token::plus, Token::minus, Token::slash, Token::eoi))
+        uint8_t Prec;     // 0 marks an open parenthesis
+        uint8_t Op;       // BinaryOp::Operator
+    };
+    llvm::SmallVector<Expr *, 16> Operands;
+    llvm::SmallVector<Pending, 16> Ops;
+    unsigned OpenParens = 0;
+
+    // Combine the top two operands with the top operator.
+    auto reduce = [&]() {
+        Expr *Right = Operands.pop_back_val();
+        Expr *Left = Operands.pop_back_val();
+        BinaryOp::Operator Op = (BinaryOp::Operator)Ops.pop_back_val().Op;
+        if (CheckSemantics && Op == BinaryOp::slash)
+        {
+            Final *F = llvm::dyn_cast<Final>(Right);
+            if (F && F->getKind() == Final::Num && F->getNumber() == 0)
+            {
+                *Diags << "Division by zero is not allowed." << "\n";
+                HasSemanticError = true;
+            }
+        }
+        Operands.push_back(makeBinaryOp(Op, Left, Right));
+    };
+
+    while (true)
+    {
+        // An operand, possibly behind opening parentheses.
+        while (Tok.is(Token::l_paren))
+        {
+            Ops.push_back({0, 0});
+            ++OpenParens;
             advance();
-        break;
-    }
-    return Res;
-}
+        }
+        if (Tok.is(Token::number))
+            Operands.push_back(makeFinal(Final::Num, Tok.getText(), Tok.getNumber()));
+        else if (Tok.is(Token::ident))
+        {
+            Operands.push_back(makeFinal(Final::Id, Tok.getText(), Tok.getSymbol()));
+            if (CheckSemantics)
+                checkUse(Tok.getText(), Tok.getSymbol());
+        }
+        else
+        {
+            error();
+            return nullptr;
+        }
+        advance();
 
+        // Closing parentheses, then either an infix operator or the end.
+        while (Tok.is(Token::r_paren) && OpenParens)
+        {
+            while (Ops.back().Prec != 0)
+                reduce();
+            Ops.pop_back();
+            --OpenParens;
+            advance();
+        }
 
+        const InfixOperator &Info = InfixOperators.Ops[Tok.getKind()];
+        if (Info.Prec == 0 || Info.IsComparison)
+            break;
 
+        // Reduce everything that binds at least as tightly, except that a
+        // right-associative operator leaves an equal-precedence one pending.
+        while (!Ops.empty() && Ops.back().Prec != 0 &&
+               (Ops.back().Prec > Info.Prec || (Ops.back().Prec == Info.Prec && !Info.RightAssoc)))
+            reduce();
+        Ops.push_back({Info.Prec, Info.Op});
+        advance();
+    }
 
+    if (OpenParens)
+    {
+        error();
+        return nullptr;
+    }
+    while (!Ops.empty())
+        reduce();
+    return Operands.back();
+}
 
-Expr *Parser::parseIf() {
+// Parses "begin" equations "end" into Equations.
+bool Parser::parseBlock(llvm::SmallVector<Equation *> &Equations)
+{
+    if (consume(Token::KW_begin))
+        return false;
+    while (Tok.is(Token::ident))
+    {
+        Equation *Eq = parseEquation();
+        if (!Eq)
+            return false;
+        Equations.push_back(Eq);
+    }
+    return !consume(Token::KW_end);
+}
 
-    Conditions condits = parseConditions();
+If *Parser::parseIf()
+{
+    C *Conditions;
     llvm::SmallVector<Equation *> Equations;
     llvm::SmallVector<Elif *> Elifs;
-    ElseParse *Else;
-    if(expect(Token::KW_if))
+    Else *ElseState = nullptr;
+
+    if (consume(Token::KW_if))
         goto _error;
-    advance();
-    if(expect(Token::KW_colon))
+    Conditions = parseC();
+    if (!Conditions)
         goto _error;
-    advance();
-     if(expect(Token::KW_begin))
+    if (consume(Token::colon))
         goto _error;
-    advance();
-    while(Tok.is(Token::id)){
-        Equation Eq = parseEquation();
-        Equations.push_back(E);
-    }
-
-
-    if(expect(Token::KW_end))
+    if (!parseBlock(Equations))
         goto _error;
-    advance();
 
-    while(Tok.is(Token::KW_elif)){
-        ElifParse Ef;
-        Ef = parseElif();
+    while (Tok.is(Token::KW_elif))
+    {
+        Elif *Ef = parseElif();
+        if (!Ef)
+            goto _error;
         Elifs.push_back(Ef);
     }
 
-    if(Tok.is(Token::KW_else))
-        Else = parseElif();
+    if (Tok.is(Token::KW_else))
+    {
+        ElseState = parseElse();
+        if (!ElseState)
+            goto _error;
+    }
 
-    return new If(condits , Equations , Elifs , Else); //check this out
-    
+    return Context.create<If>(Conditions, Context.copy(Equations), Context.copy(Elifs), ElseState);
+_error:
+    skipToEnd();
+    return nullptr;
 }
 
-
-
-Expr *Parser::parseElif()
+Elif *Parser::parseElif()
 {
+    C *Conditions;
     llvm::SmallVector<Equation *> Equations;
-    Conditions condits = parseConditions();
 
-    if(expect(Token::KW_elif))
+    if (consume(Token::KW_elif))
         goto _error;
-    
-    advance();
-
-    if(expect(Token::KW_colon))
+    Conditions = parseC();
+    if (!Conditions)
         goto _error;
-    
-    advance();
-
-    if(expect(Token::KW_begin))
+    if (consume(Token::colon))
         goto _error;
-    
-    advance();
-
-    while(Tok.is(Token::id)){
-        Equation Eq = parseEquation();
-        Equations.push_back(Eq);
-    }
-
-    if(expect(Token::KW_end))
+    if (!parseBlock(Equations))
         goto _error;
-    
-    advance();
-    
-    return new ElifParse(condits , Equations); //check this out
-
 
+    return Context.create<Elif>(Conditions, Context.copy(Equations));
+_error:
+    skipToEnd();
+    return nullptr;
 }
 
-Expr *Parser::parseElse(){
+Else *Parser::parseElse()
+{
     llvm::SmallVector<Equation *> Equations;
-    if(expect(Token::KW_else))
-        goto _error;
-    
-    advance();
 
-    if(expect(Token::KW_colon))
+    if (consume(Token::KW_else))
         goto _error;
-    
-    advance();
-
-
-    while(Tok.is(Token::id)){
-        Equation Eq = parseEquation();
-        Equations.push_back(Eq);
-    }
-
-
-    if(expect(Token::KW_end))
+    if (consume(Token::colon))
+        goto _error;
+    if (!parseBlock(Equations))
         goto _error;
-    
-    advance();
-
-
-
-    return new ElifParse(Equations);
-
 
+    return Context.create<Else>(Context.copy(Equations));
+_error:
+    skipToEnd();
+    return nullptr;
 }
 
-Conditions *Parser::parseConditions(){
-
-    Conditions *Left = parseCondition();
-    while (Tok.isOneOf(Token::KW_and , Token::KW_or)){
-        Conditions :: andOr AO = 
-            Tok.is(Token::KW_and) ? Conditions::KW_and : Conditions::KW_or;
+C *Parser::parseC()
+{
+    C *Left = parseCondition();
+    while (Left && Tok.isOneOf(Token::KW_and, Token::KW_or))
+    {
+        C::LogicOp LOp = Tok.is(Token::KW_and) ? C::KW_and : C::KW_or;
         advance();
-        Conditions *Right = parseCondition();
-        Left = new Conditions(AO , Left , Right);  
+        C *Right = parseCondition();
+        if (!Right)
+            return nullptr;
+        Left = Context.create<C>(Left, Right, LOp);
     }
     return Left;
 }
 
-
-Condition *Parser::parseCondition () {
+C *Parser::parseCondition()
+{
     Expr *Left = parseExpr();
-    while (Tok.isOneOf(Token::KW_EqEq, Token::KW_eqNot , Token::KW_greaterEqual , Token::KW_lessEqual , Token::KW_lessThan , Token::KW_greaterThan)) {
-        Condition::OperatorCondition Op;
-            if (Tok.is(Token::KW_EqEq)) 
-                Op = Condition::OperatorCondition::KW_EqEq;
-            else if (Tok.is(Token::KW_eqNot))  
-                Op= Condition::OperatorCondition::KW_eqNot;
-            else if (Tok.is(Token::KW_greaterEqual))  
-                Op= Condition::OperatorCondition::KW_greaterEqual;
-            else if (Tok.is(Token::KW_lessEqual))  
-                Op= Condition::OperatorCondition::KW_lessEqual;
-            else if (Tok.is(Token::KW_lessThan))  
-                Op= Condition::OperatorCondition::KW_lessThan;
-            else if (Tok.is(Token::KW_greaterThan))  
-                Op= Condition::OperatorCondition::KW_greaterThan;
-            else 
-                goto _error;
-            advance();
-            Expr *Right = parseExpr();
-            Left = new Condition(Op, Left, Right);
-    }
-    return Left;
-
-}
-
-Loop *Parser:: parseLoop(){
-    Loop *Res = nullptr;
-    if(!Tok.is(Token::KW_loopc)){
-        goto _error;
+    if (!Left)
+        return nullptr;
+    const InfixOperator &Info = InfixOperators.Ops[Tok.getKind()];
+    if (!Info.IsComparison)
+    {
+        error();
+        return nullptr;
     }
     advance();
+    Expr *Right = parseExpr();
+    if (!Right)
+        return nullptr;
+    return Context.create<Condition>(Left, Right, (Condition::OperatorCondition)Info.Op);
+}
 
-    Conditions *Conditions = parseConditions;
-    advance();
+Loop *Parser::parseLoop()
+{
+    C *Conditions;
+    llvm::SmallVector<Equation *> Equations;
 
-    if(!Tok.is(Token::KW_colon)){
+    if (consume(Token::KW_loopc))
         goto _error;
-    }
-
-    advance();
-    if (!Tok.is(Token::KW_begin))
-    {
+    Conditions = parseC();
+    if (!Conditions)
+        goto _error;
+    if (consume(Token::colon))
+        goto _error;
+    if (!parseBlock(Equations))
         goto _error;
-    }
-    advance();
-    llvm::SmallVector<Equation*> Equ;
-
-    while(!Tok.is(Token::id)){
-        if(Tok.is(Token::id)){
-            Equation *e;
-            e = parseEquation();
-
-            if (!Tok.is(Token::semicolon))
-            {
-                goto _error;
-            }
-            if(e)
-            {
-                Equation.push_back(e);
-            }
-            
-        }
-    }
-
-    Res = new Loop(Conditions,Equation);
-    return Res;
-}
-
 
+    return Context.create<Loop>(Conditions, Context.copy(Equations));
 _error:
-{
-    while (Tok.getKind() != Token::eoi)
-        advance();
-    return nullptr;   
-}
\ No newline at end of file
+    skipToEnd();
+    return nullptr;
+}
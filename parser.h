@@ -2,20 +2,70 @@
 #define PARSER_H
 
 #include "AST.h"
+#include "ASTContext.h"
 #include "Lexer.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Support/raw_ostream.h"
 
 class Parser {
-    Lexer &Lex;
+    ASTContext &Context;        // Owns every node the parser builds.
+    Lexer *Lex;                 // Pulls tokens on demand, or
+    const TokenStream *Tokens;  // reads them from a pre-lexed stream.
+    unsigned Index;             // Position of Tok in Tokens.
+    unsigned Limit;             // Tokens at or after Limit read as eoi.
     Token Tok;
+    llvm::raw_ostream *Diags;   // Where errors are reported.
     bool HasError;
+    bool CheckSemantics;        // Run the checks of Sema while building nodes.
+    bool HasSemanticError;
+    llvm::BitVector Scope;      // Variables declared so far, when checking.
+    bool HashCons;              // Build one node for identical expressions.
+    // Expression nodes built so far when hash-consing, leaves by kind and
+    // value, operations by operator and operands.
+    llvm::DenseMap<std::pair<unsigned, uint32_t>, Final *> Leaves;
+    llvm::DenseMap<std::pair<unsigned, std::pair<Expr *, Expr *>>, BinaryOp *> Operations;
 
     void error() 
     {
-        llvm::errs() << "Unexpected: " << Tok.getText() << "\n";
+        *Diags << "Unexpected: " << Tok.getText() << "\n";
         HasError = true;
     }
-    void advance() { Lex.next(Tok); }
+    // The checks of Sema's InputCheck, applied to identifiers as they are
+    // read and to variables as their declaration is parsed.
+    void checkUse(llvm::StringRef Name, uint32_t Symbol)
+    {
+        if (Symbol < Scope.size() && Scope.test(Symbol))
+            return;
+        *Diags << "Variable " << Name << " is not declared\n";
+        HasSemanticError = true;
+    }
+    void declare(llvm::StringRef Name, uint32_t Symbol)
+    {
+        if (Symbol >= Scope.size())
+            Scope.resize(Symbol + 1);
+        else if (Scope.test(Symbol))
+        {
+            *Diags << "Variable " << Name << " is already declared\n";
+            HasSemanticError = true;
+        }
+        Scope.set(Symbol);
+    }
+
+    Final *makeFinal(Final::ValueKind Kind, llvm::StringRef Text, uint32_t Value);
+    BinaryOp *makeBinaryOp(BinaryOp::Operator Op, Expr *Left, Expr *Right);
+
+    void readToken() { Tokens->get(Index < Limit ? Index : Tokens->size(), Tok); }
+    void advance()
+    {
+        if (Tokens)
+        {
+            ++Index;
+            readToken();
+        }
+        else
+            Lex->next(Tok);
+    }
 
     bool expect(Token::TokenKind Kind) 
     {
@@ -35,26 +85,62 @@ class Parser {
         return false;
     }
 
-    AST *parseGoal();
-    Expr *parseDec();
-    Expr *parseEquation();
+    void skipToEnd()
+    {
+        while (!Tok.is(Token::eoi))
+            advance();
+    }
+
+    Goal *parseGoal();
+    Statement *parseStatement();
+    Declaration *parseDec();
+    Equation *parseEquation();
+    bool parseBlock(llvm::SmallVector<Equation *> &Equations);
     Expr *parseExpr();
-    Expr *parseTerm();
-    Expr *parseFactor();
-    Expr *parseFinal();
-    Expr *parseCondition();
-    Expr *parseIf();
-    Expr *parseElif();
-    Expr *parseElse();
-    Expr *parseC();
-    Expr *parseLoop();
+    C *parseCondition();
+    If *parseIf();
+    Elif *parseElif();
+    Else *parseElse();
+    C *parseC();
+    Loop *parseLoop();
 
     public:
-    Parser(Lexer &Lex) : Lex(Lex), HasError(false) { advance(); }
+    Parser(Lexer &Lex, ASTContext &Context)
+        : Context(Context), Lex(&Lex), Tokens(nullptr), Index(0), Limit(0), Diags(&llvm::errs()), HasError(false),
+          CheckSemantics(false), HasSemanticError(false), HashCons(false)
+    {
+        advance();
+    }
+    Parser(const TokenStream &Tokens, ASTContext &Context) : Parser(Tokens, 0, Tokens.size(), Context) {}
+
+    // Parse only the tokens in [Begin, End) of the stream.
+    Parser(const TokenStream &Tokens, unsigned Begin, unsigned End, ASTContext &Context)
+        : Context(Context), Lex(nullptr), Tokens(&Tokens), Index(Begin), Limit(End), Diags(&llvm::errs()),
+          HasError(false),
+          CheckSemantics(false), HasSemanticError(false), HashCons(false)
+    {
+        readToken();
+    }
+
+    bool hasError() { return HasError; }
 
-    bool HasError() {return HasError(); }
+    // Report errors to OS instead of stderr.
+    void setDiagnostics(llvm::raw_ostream &OS) { Diags = &OS; }
+
+    // Check declarations and uses while parsing, so the program needs no
+    // separate Sema pass. Only valid when one parser sees the whole program.
+    void setCheckSemantics(bool Check) { CheckSemantics = Check; }
+    bool hasSemanticError() { return HasSemanticError; }
+
+    // Hand out the same node for every occurrence of an expression this
+    // parser sees, marking it shared. Statements are never shared.
+    void setHashCons(bool Enable) { HashCons = Enable; }
 
     AST *parse();
+
+    // Parse statements up to the end of input into Statements, used to parse
+    // one chunk of a program.
+    void parseStatements(llvm::SmallVector<Statement *> &Statements);
 };
 
 #endif
\ No newline at end of file